@@ -0,0 +1,351 @@
+/*********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  chrdevUringApp.c
+ *    Description:  mode=fifo下每次操作一次系统调用与io_uring批量提交的吞吐对比
+ *
+ *        Version:  1.0.0(2023年04月17日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年04月17日 00时20分54秒"
+ *
+ ********************************************************************************/
+
+
+#define _GNU_SOURCE			// pwritev2、RWF_NOWAIT
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * ./chrdevUringApp [MB] [rec_size]
+ *
+ * 写者线程和读者线程各自以rec_size为单位搬运MB兆字节：
+ *   sync     每次read/write一次系统调用
+ *   uring N  每个线程一个io_uring，保持N个READV/WRITEV在途，一次io_uring_enter提交并收割一批
+ * 不依赖liburing，直接使用io_uring_setup/io_uring_enter系统调用。
+ * */
+
+#define DEV_PATH			"/dev/chrdev0"	// 默认设备，可用环境变量CHRDEV指定其他实例
+#define BENCH_DEF_MB		64
+#define BENCH_DEF_REC		256
+#define URING_MAX_DEPTH		64
+
+static const unsigned int uring_depths[] = {1, 4, 16, 64};
+
+struct uring {
+	int						fd;
+	unsigned int			*sq_head;
+	unsigned int			*sq_tail;
+	unsigned int			*sq_mask;
+	unsigned int			*sq_array;
+	struct io_uring_sqe		*sqes;
+	unsigned int			*cq_head;
+	unsigned int			*cq_tail;
+	unsigned int			*cq_mask;
+	struct io_uring_cqe		*cqes;
+};
+
+struct bench_arg {
+	int				fd;
+	int				write;		// 1为写者，0为读者
+	unsigned int	depth;		// 0为sync
+	size_t			rec_size;
+	size_t			total;
+	unsigned long	syscalls;
+	int				error;
+	int				finished;	// 线程结束前置1，bench_run据此停止补写填充
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params	p;
+	void					*sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if(r->fd < 0)
+		return -1;
+
+	sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(unsigned int), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	cq = mmap(NULL, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED)
+	{
+		close(r->fd);
+		return -1;
+	}
+
+	r->sq_head = (unsigned int *)((char *)sq + p.sq_off.head);
+	r->sq_tail = (unsigned int *)((char *)sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)sq + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+/* 只在本线程提交，sq tail用普通读，填好sqe后以release语义发布 */
+static void uring_queue(struct uring *r, int write, int fd, struct iovec *iov, unsigned int slot)
+{
+	unsigned int			tail = *r->sq_tail;
+	unsigned int			idx = tail & *r->sq_mask;
+	struct io_uring_sqe		*sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)iov;
+	sqe->len = 1;
+	sqe->off = 0;		// FIFO不可定位，偏移被忽略
+	sqe->user_data = slot;
+	r->sq_array[idx] = idx;
+
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int uring_enter(struct uring *r, unsigned int to_submit, unsigned int min_complete)
+{
+	return syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/* sync：每条记录一次read/write */
+static void bench_sync(struct bench_arg *arg, char *buf)
+{
+	size_t		done = 0;
+	ssize_t		rv;
+
+	while(done < arg->total)
+	{
+		if(arg->write)
+			rv = write(arg->fd, buf, arg->rec_size);
+		else
+			rv = read(arg->fd, buf, arg->rec_size);
+		arg->syscalls++;
+		if(rv <= 0)
+		{
+			arg->error = errno;
+			return;
+		}
+		done += rv;
+	}
+}
+
+/*
+ * uring：保持depth个请求在途，每轮把新请求和收割合并为一次io_uring_enter。
+ * FIFO可能只写入/读出部分字节，按完成的字节数计量；读者在途请求可能超过剩余数据量，
+ * 由bench_run在写者结束后补写的填充数据完成。
+ */
+static void bench_uring(struct bench_arg *arg, char *buf)
+{
+	struct uring		r;
+	struct iovec		iov[URING_MAX_DEPTH];
+	unsigned int		slots[URING_MAX_DEPTH];
+	unsigned int		nfree = 0, inflight = 0, newq, head, i;
+	size_t				queued = 0, done = 0;
+	struct io_uring_cqe	*cqe;
+
+	if(uring_init(&r, arg->depth) < 0)
+	{
+		arg->error = errno;
+		return;
+	}
+
+	for(i = 0; i < arg->depth; i++)
+	{
+		iov[i].iov_base = buf + i * arg->rec_size;
+		slots[nfree++] = i;
+	}
+
+	while(done < arg->total || inflight)
+	{
+		newq = 0;
+		while(nfree && (arg->write ? queued < arg->total : done < arg->total))
+		{
+			i = slots[--nfree];
+			iov[i].iov_len = arg->rec_size;
+			if(arg->write && arg->total - queued < arg->rec_size)
+				iov[i].iov_len = arg->total - queued;
+			uring_queue(&r, arg->write, arg->fd, &iov[i], i);
+			queued += iov[i].iov_len;
+			inflight++;
+			newq++;
+		}
+
+		if(uring_enter(&r, newq, 1) < 0 && errno != EINTR)
+		{
+			arg->error = errno;
+			break;
+		}
+		arg->syscalls++;
+
+		head = *r.cq_head;
+		while(head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &r.cqes[head & *r.cq_mask];
+			i = cqe->user_data;
+			if(cqe->res < 0)
+			{
+				arg->error = -cqe->res;
+				inflight = 0;
+				done = arg->total;
+				break;
+			}
+			done += cqe->res;
+			if(arg->write)
+				queued -= iov[i].iov_len - cqe->res;	// 没写完的部分重新排队
+			slots[nfree++] = i;
+			inflight--;
+			head++;
+		}
+		__atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	close(r.fd);
+}
+
+static void *bench_thread(void *data)
+{
+	struct bench_arg	*arg = data;
+	char				*buf = malloc(URING_MAX_DEPTH * arg->rec_size);
+
+	memset(buf, 0x5a, URING_MAX_DEPTH * arg->rec_size);
+	if(arg->depth)
+		bench_uring(arg, buf);
+	else
+		bench_sync(arg, buf);
+
+	free(buf);
+	__atomic_store_n(&arg->finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * 写者结束后一直补写填充直到读者结束，让读者多余的在途请求能够完成。
+ * 用RWF_NOWAIT不阻塞：填充量可能超过FIFO容量，阻塞写会在读者收割完后永远等不到空间；
+ * 也不能给共用的fd设O_NONBLOCK，那样读者的io_uring请求会直接返回EAGAIN。
+ */
+static void bench_pad(int fd, struct bench_arg *rd)
+{
+	char			buf[BENCH_DEF_REC];
+	struct iovec	iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+	memset(buf, 0x5a, sizeof(buf));
+	while(!__atomic_load_n(&rd->finished, __ATOMIC_ACQUIRE))
+	{
+		if(pwritev2(fd, &iov, 1, -1, RWF_NOWAIT) < 0)
+			usleep(100);	// FIFO满了，等读者取走
+	}
+}
+
+/* 清空上一轮残留的填充数据 */
+static void fifo_drain(int fd)
+{
+	char	buf[4096];
+	int		flags = fcntl(fd, F_GETFL);
+
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	while(read(fd, buf, sizeof(buf)) > 0)
+		;
+	fcntl(fd, F_SETFL, flags);
+}
+
+static int bench_run(int fd, unsigned int depth, size_t rec_size, size_t total)
+{
+	struct bench_arg	wr = { .fd = fd, .write = 1, .depth = depth, .rec_size = rec_size, .total = total };
+	struct bench_arg	rd = { .fd = fd, .write = 0, .depth = depth, .rec_size = rec_size, .total = total };
+	pthread_t			wtid, rtid;
+	double				start, sec;
+	unsigned long		syscalls;
+
+	fifo_drain(fd);
+
+	start = now_sec();
+	pthread_create(&rtid, NULL, bench_thread, &rd);
+	pthread_create(&wtid, NULL, bench_thread, &wr);
+	pthread_join(wtid, NULL);
+	if(depth)
+		bench_pad(fd, &rd);
+	pthread_join(rtid, NULL);
+	sec = now_sec() - start;
+
+	if(wr.error || rd.error)
+	{
+		printf("%s depth %u failure: %s\n", depth ? "uring" : "sync", depth, strerror(wr.error ? wr.error : rd.error));
+		return -1;
+	}
+
+	syscalls = wr.syscalls + rd.syscalls;
+	if(depth)
+		printf("uring %-4u", depth);
+	else
+		printf("%-10s", "sync");
+	printf(" %10.1f %12lu %12.1f\n", total / sec / (1 << 20), syscalls, (double)total * 2 / rec_size / syscalls);
+
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	int				fd;
+	size_t			mb = BENCH_DEF_MB;
+	size_t			rec_size = BENCH_DEF_REC;
+	unsigned int	i;
+	const char		*path = getenv("CHRDEV") ? getenv("CHRDEV") : DEV_PATH;
+
+	if(argc > 3)
+	{
+		printf("Usage: %s [MB] [rec_size]\n", argv[0]);
+		return -1;
+	}
+	if(argc >= 2)
+		mb = strtoul(argv[1], NULL, 0);
+	if(argc == 3)
+		rec_size = strtoul(argv[2], NULL, 0);
+	if(mb == 0 || rec_size == 0)
+	{
+		printf("Usage: %s [MB] [rec_size]\n", argv[0]);
+		return -1;
+	}
+
+	fd = open(path, O_RDWR);
+	if(fd == -1)
+	{
+		printf("can't open file %s\n", path);
+		return -1;
+	}
+
+	printf("%-10s %10s %12s %12s\n", "mode", "MB/s", "syscalls", "ops/call");
+	bench_run(fd, 0, rec_size, mb << 20);
+	for(i = 0; i < sizeof(uring_depths) / sizeof(uring_depths[0]); i++)
+		bench_run(fd, uring_depths[i], rec_size, mb << 20);
+
+	close(fd);
+	return 0;
+}
@@ -27,6 +27,34 @@
 #include <linux/tty.h>
 #include <linux/kmod.h>
 #include <linux/gfp.h>
+#include <linux/cdev.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched/signal.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/log2.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/page-flags.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/rcupdate.h>
+#include <linux/kref.h>
+#include <linux/spinlock.h>
+#include <linux/overflow.h>
+#include <linux/seqlock.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/list.h>
+#include <linux/file.h>
+#include "chrdevbase.h"
 
 /* 确定主设备号 */
 //#define DEV_MAJOR		79
@@ -38,65 +66,2099 @@ int dev_major = DEV_MAJOR;			//主设备号
 
 #define DEV_NAME		"chrdev"	//设备名称
 
-static struct cdev *chrtest_cdev;	//cdev结构体
+static struct class *chrdev_class;	//定义一个class用于自动创建类
+
+/* FIFO大小，向上取整为2的幂且至少一页，以便整体mmap到用户空间 */
+static unsigned int fifo_size = 4096;
+module_param(fifo_size, uint, S_IRUGO);
+MODULE_PARM_DESC(fifo_size, "FIFO/per-CPU shard/log/dgram size rounded up to a power of two, or the largest snapshot, in bytes");
+
+/*
+ * 工作模式：fifo为可mmap的环形缓冲区，blob为按需分配页、可定位的大缓冲区，
+ * shard为每个CPU一个环形缓冲区，多个写者并发写入时互不加锁，
+ * snapshot为版本化的快照，读者总能读到某个完整版本且不会阻塞写者，
+ * log为广播日志，每个open各有自己的读位置，都能读到全部消息，
+ * dgram为保留消息边界的队列，可用ioctl一次批量取出多条消息
+ */
+static char *mode = "fifo";
+module_param(mode, charp, S_IRUGO);
+MODULE_PARM_DESC(mode, "Buffer mode: fifo, blob, shard, snapshot, log or dgram");
+
+/* blob模式的容量，页在第一次访问时才分配，所以可以设得很大 */
+static unsigned long blob_size = 64 << 20;
+module_param(blob_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(blob_size, "Blob mode capacity in bytes, pages are allocated on first touch");
+
+/* 设备个数，创建/dev/chrdev0 ~ /dev/chrdev(nr_devs-1) */
+static unsigned int nr_devs = 1;
+module_param(nr_devs, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_devs, "Number of /dev/chrdevN instances, each with its own buffer");
+
+/*
+ * 每个设备的私有数据：环形缓冲区、读写锁和等待队列。
+ * 每个设备独占cache line，读者和写者各自常改的字段也分到不同的cache line，避免伪共享。
+ */
+struct chrdev_dev {
+	struct cdev				cdev;		// cdev结构体
+	void					*ring_mem;	// vmalloc_user分配：控制页 + 数据区，可直接remap给用户空间
+	struct chrdev_ring_ctrl	*ctrl;		// 控制页，head/tail与用户空间共享
+	u8						*data;		// 数据区，读走的数据即被消费
+	u32						size;		// 数据区大小，2的幂
+
+	struct page				**pages;	// blob模式的页表，未访问过的页为NULL
+	unsigned long			npages;		// blob模式容量对应的页数
+	atomic64_t				blob_len;	// blob模式已写入的最远位置，读到这里即为EOF
+
+	struct chrdev_shard __percpu	*shards;	// shard模式每个CPU的环形缓冲区
+	atomic64_t				wseq;		// shard模式下一条记录的全局序号
+
+	struct chrdev_snap __rcu	*snap;		// snapshot模式当前发布的版本
+	u64						snap_version;	// snapshot模式最新的版本号，写者在wlock下递增
+
+	seqcount_t				log_seq;	// log模式保护log_start/log_head，32位平台上u64不能原子读写
+	u64						log_start;	// log模式最早仍保留的消息位置
+	u64						log_head;	// log模式下一条消息的写入位置
+
+	/* 读者一侧 */
+	struct mutex			rlock ____cacheline_aligned_in_smp;	// 读者之间互斥，单读单写时环形缓冲区本身无需加锁
+	wait_queue_head_t		r_wait;		// FIFO空时读者在此睡眠
+	u64						rseq;		// shard模式读者下一条要输出的序号
+
+	/* 写者一侧 */
+	struct mutex			wlock ____cacheline_aligned_in_smp;	// 写者之间互斥
+	wait_queue_head_t		w_wait;		// FIFO满时写者在此睡眠
+} ____cacheline_aligned_in_smp;
+
+/*
+ * shard模式每个CPU的环形缓冲区：写者只在当前CPU的分片上追加记录，
+ * 每条记录带全局序号，读者按序号从各分片中归并输出。
+ */
+struct chrdev_shard {
+	struct mutex			lock;		// 只在同一分片上的写者之间互斥，不同CPU的写者互不影响
+	u8						*data;
+	u32						size;		// 2的幂
+	u32						head;		// 写者推进
+	u32						tail;		// 读者推进
+	u32						rec_off;	// 读者在当前记录中已读出的字节数
+	wait_queue_head_t		w_wait;		// 等待本分片空间的写者，读者腾出空间只唤醒这个分片上的写者
+};
+
+/* 分片中的记录头，数据紧跟其后，整条记录按8字节对齐 */
+struct chrdev_shard_rec {
+	u64						seq;
+	u32						len;
+	u32						reserved;
+};
+
+/*
+ * snapshot模式的一个版本：写者每次write生成一个新版本并用RCU发布，
+ * 读者在RCU读临界区内取得引用后就可以在临界区外慢慢拷贝，旧版本在最后一个读者放手后释放
+ */
+struct chrdev_snap {
+	struct rcu_head			rcu;
+	struct kref				ref;		// 发布指针持有一份，每个正在读的文件各持有一份
+	u64						version;
+	size_t					len;
+	u8						data[];
+};
+
+/* snapshot模式每次open的私有数据：固定住正在读的版本，保证分多次read也是同一个版本 */
+struct chrdev_snap_file {
+	struct chrdev_dev		*dev;
+	spinlock_t				lock;		// 保护snap指针的替换
+	struct chrdev_snap		*snap;		// 当前读的版本，从偏移0开始读时换成最新版本
+};
+
+/* log和dgram模式中的消息头，消息数据紧跟其后，整条消息按8字节对齐 */
+struct chrdev_msg_hdr {
+	u32						len;
+	u32						reserved;
+};
+
+/* log模式每次open的私有数据：各自独立的读位置 */
+struct chrdev_log_file {
+	struct chrdev_dev		*dev;
+	struct mutex			lock;		// 同一个fd上并发read时保护pos
+	u64						pos;
+};
+
+/* 导出为dma-buf的一组页，每页持有一份引用，最后一个使用者放手后才释放 */
+struct chrdev_dmabuf {
+	struct mutex			lock;		// 保护attachments
+	struct list_head		attachments;
+	struct page				**pages;
+	unsigned int			npages;
+};
+
+/* 每个导入设备一份sg_table，dir为DMA_NONE表示当前没有映射 */
+struct chrdev_dmabuf_attach {
+	struct list_head		node;
+	struct device			*dev;
+	struct sg_table			sgt;
+	enum dma_data_direction	dir;
+};
+
+/* 不同工作模式各自的fops和缓冲区分配/释放函数 */
+struct chrdev_mode {
+	const char						*name;
+	const struct file_operations	*fops;
+	int								(*alloc)(struct chrdev_dev *dev);
+	void							(*free)(struct chrdev_dev *dev);
+};
+
+static const struct chrdev_mode *chrdev_mode;
+
+/*
+ * nr_devs个设备各自单独kzalloc：kcalloc的数组只保证slab的最小对齐，
+ * struct chrdev_dev的大小是cache line的整数倍，单独分配才会落在按cache line对齐的kmalloc对象上，
+ * ____cacheline_aligned_in_smp的成员之间、设备之间才真正不共享cache line。
+ */
+static struct chrdev_dev **chrdevs;
+
+/*
+ * 环形缓冲区中已有的数据量。下标可能被mmap的用户程序改写，所以结果要限制在size以内，
+ * 保证内核按 & (size-1) 取位置时不会越界。
+ */
+static inline u32 ring_used(struct chrdev_dev *dev)
+{
+	u32 used = smp_load_acquire(&dev->ctrl->head) - smp_load_acquire(&dev->ctrl->tail);
+
+	return min(used, dev->size);
+}
+
+static inline bool ring_empty(struct chrdev_dev *dev)
+{
+	return ring_used(dev) == 0;
+}
+
+static inline bool ring_full(struct chrdev_dev *dev)
+{
+	return ring_used(dev) == dev->size;
+}
+
+static int ring_alloc(struct chrdev_dev *dev)
+{
+	unsigned int size = fifo_size;
+
+	if(size == 0 || size > (1U << 31))
+		return -EINVAL;
+
+	size = roundup_pow_of_two(max_t(unsigned int, size, PAGE_SIZE));
+
+	dev->ring_mem = vmalloc_user(PAGE_SIZE + size);		// 已清零，head == tail即为空
+	if(!dev->ring_mem)
+		return -ENOMEM;
+
+	dev->ctrl = dev->ring_mem;
+	dev->data = (u8 *)dev->ring_mem + PAGE_SIZE;
+	dev->size = size;
+	dev->ctrl->size = size;
+
+	return 0;
+}
+
+static void ring_free(struct chrdev_dev *dev)
+{
+	vfree(dev->ring_mem);
+	dev->ring_mem = NULL;
+}
+
+/* 在数据区的pos处读写n字节内核数据，处理回绕；pos为自由增长的下标 */
+static void ring_put(struct chrdev_dev *dev, u64 pos, const void *src, u32 n)
+{
+	u32 off = (u32)pos & (dev->size - 1);
+	u32 first = min(n, dev->size - off);
+
+	memcpy(dev->data + off, src, first);
+	memcpy(dev->data, src + first, n - first);
+}
+
+static void ring_get(struct chrdev_dev *dev, u64 pos, void *dst, u32 n)
+{
+	u32 off = (u32)pos & (dev->size - 1);
+	u32 first = min(n, dev->size - off);
+
+	memcpy(dst, dev->data + off, first);
+	memcpy(dst + first, dev->data, n - first);
+}
+
+/* 带消息头的一条消息占用的字节数 */
+#define MSG_ALIGN		8
+
+static inline u32 msg_bytes(u32 len)
+{
+	return ALIGN(sizeof(struct chrdev_msg_hdr) + len, MSG_ALIGN);
+}
+
+
+/*
+ *+------------------------------------------------------------------------------+ 
+ *|  dma-buf导出：把fifo的数据区或blob的页交给其他驱动/进程零拷贝使用，
+ *|  导入方通过dma_buf_map_attachment拿到sg_table，CPU访问前后由begin/end_cpu_access同步cache
+ *+------------------------------------------------------------------------------+
+ */
+static int chrdev_dmabuf_attach(struct dma_buf *dmabuf, struct dma_buf_attachment *attach)
+{
+	struct chrdev_dmabuf		*buf = dmabuf->priv;
+	struct chrdev_dmabuf_attach	*a;
+	int							rv;
+
+	a = kzalloc(sizeof(*a), GFP_KERNEL);
+	if(!a)
+		return -ENOMEM;
+
+	rv = sg_alloc_table_from_pages(&a->sgt, buf->pages, buf->npages, 0,
+			(unsigned long)buf->npages << PAGE_SHIFT, GFP_KERNEL);
+	if(rv)
+	{
+		kfree(a);
+		return rv;
+	}
+
+	a->dev = attach->dev;
+	a->dir = DMA_NONE;
+	attach->priv = a;
+
+	mutex_lock(&buf->lock);
+	list_add(&a->node, &buf->attachments);
+	mutex_unlock(&buf->lock);
+
+	return 0;
+}
+
+static void chrdev_dmabuf_detach(struct dma_buf *dmabuf, struct dma_buf_attachment *attach)
+{
+	struct chrdev_dmabuf		*buf = dmabuf->priv;
+	struct chrdev_dmabuf_attach	*a = attach->priv;
+
+	mutex_lock(&buf->lock);
+	list_del(&a->node);
+	mutex_unlock(&buf->lock);
+
+	sg_free_table(&a->sgt);
+	kfree(a);
+}
+
+static struct sg_table *chrdev_dmabuf_map(struct dma_buf_attachment *attach, enum dma_data_direction dir)
+{
+	struct chrdev_dmabuf		*buf = attach->dmabuf->priv;
+	struct chrdev_dmabuf_attach	*a = attach->priv;
+	int							nents;
+
+	/* 检查、映射和设置dir在同一个临界区内，begin/end_cpu_access不会看到映射到一半的sgt */
+	mutex_lock(&buf->lock);
+	if(a->dir != DMA_NONE)
+	{
+		mutex_unlock(&buf->lock);
+		return ERR_PTR(-EBUSY);
+	}
+
+	nents = dma_map_sg(a->dev, a->sgt.sgl, a->sgt.orig_nents, dir);	// 非一致性平台上同时把cache写回
+	if(!nents)
+	{
+		mutex_unlock(&buf->lock);
+		return ERR_PTR(-ENOMEM);
+	}
+	a->sgt.nents = nents;
+	a->dir = dir;
+	mutex_unlock(&buf->lock);
+
+	return &a->sgt;
+}
+
+static void chrdev_dmabuf_unmap(struct dma_buf_attachment *attach, struct sg_table *sgt, enum dma_data_direction dir)
+{
+	struct chrdev_dmabuf		*buf = attach->dmabuf->priv;
+	struct chrdev_dmabuf_attach	*a = attach->priv;
+
+	mutex_lock(&buf->lock);
+	a->dir = DMA_NONE;
+	mutex_unlock(&buf->lock);
+
+	dma_unmap_sg(a->dev, sgt->sgl, sgt->orig_nents, dir);
+}
+
+/* CPU访问前：让已映射的设备写入的数据对CPU可见 */
+static int chrdev_dmabuf_begin_cpu_access(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+	struct chrdev_dmabuf		*buf = dmabuf->priv;
+	struct chrdev_dmabuf_attach	*a;
+
+	mutex_lock(&buf->lock);
+	list_for_each_entry(a, &buf->attachments, node)
+	{
+		if(a->dir != DMA_NONE)
+			dma_sync_sg_for_cpu(a->dev, a->sgt.sgl, a->sgt.orig_nents, a->dir);
+	}
+	mutex_unlock(&buf->lock);
+
+	return 0;
+}
+
+/* CPU访问后：把CPU写入的数据写回，交还给设备 */
+static int chrdev_dmabuf_end_cpu_access(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+	struct chrdev_dmabuf		*buf = dmabuf->priv;
+	struct chrdev_dmabuf_attach	*a;
+
+	mutex_lock(&buf->lock);
+	list_for_each_entry(a, &buf->attachments, node)
+	{
+		if(a->dir != DMA_NONE)
+			dma_sync_sg_for_device(a->dev, a->sgt.sgl, a->sgt.orig_nents, a->dir);
+	}
+	mutex_unlock(&buf->lock);
+
+	return 0;
+}
+
+static int chrdev_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+	struct chrdev_dmabuf	*buf = dmabuf->priv;
+	unsigned long			i, addr = vma->vm_start;
+	int						rv;
+
+	if(vma->vm_pgoff >= buf->npages || vma_pages(vma) > buf->npages - vma->vm_pgoff)
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	for(i = 0; i < vma_pages(vma); i++, addr += PAGE_SIZE)
+	{
+		rv = vm_insert_page(vma, addr, buf->pages[vma->vm_pgoff + i]);
+		if(rv)
+			return rv;
+	}
+
+	return 0;
+}
+
+static void chrdev_dmabuf_release(struct dma_buf *dmabuf)
+{
+	struct chrdev_dmabuf	*buf = dmabuf->priv;
+	unsigned int			i;
+
+	for(i = 0; i < buf->npages; i++)
+		put_page(buf->pages[i]);
+
+	kvfree(buf->pages);
+	kfree(buf);
+}
+
+static const struct dma_buf_ops chrdev_dmabuf_ops = {
+	.attach				=	chrdev_dmabuf_attach,
+	.detach				=	chrdev_dmabuf_detach,
+	.map_dma_buf		=	chrdev_dmabuf_map,
+	.unmap_dma_buf		=	chrdev_dmabuf_unmap,
+	.begin_cpu_access	=	chrdev_dmabuf_begin_cpu_access,
+	.end_cpu_access		=	chrdev_dmabuf_end_cpu_access,
+	.mmap				=	chrdev_dmabuf_mmap,
+	.release			=	chrdev_dmabuf_release,
+};
+
+/*
+ * 把pages导出为dma-buf并把fd返回给用户。pages数组的所有权交给本函数，失败时一并释放；
+ * 每页额外持有一份引用；dma-buf存在期间模块引用计数不为0，不能卸载。
+ */
+static int chrdev_dmabuf_export(struct page **pages, unsigned int npages, struct chrdev_dmabuf_export __user *uarg)
+{
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct chrdev_dmabuf_export	args;
+	struct chrdev_dmabuf		*buf;
+	struct dma_buf				*dmabuf;
+	unsigned int				i;
+	int							fd, rv;
+
+	if(copy_from_user(&args, uarg, sizeof(args)))
+	{
+		rv = -EFAULT;
+		goto free_pages;
+	}
+	if((args.flags & ~(O_CLOEXEC | O_ACCMODE)) || (args.flags & O_ACCMODE) == O_ACCMODE)
+	{
+		rv = -EINVAL;
+		goto free_pages;
+	}
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if(!buf)
+	{
+		rv = -ENOMEM;
+		goto free_pages;
+	}
+	mutex_init(&buf->lock);
+	INIT_LIST_HEAD(&buf->attachments);
+	buf->pages = pages;
+	buf->npages = npages;
+	for(i = 0; i < npages; i++)
+		get_page(pages[i]);
+
+	exp_info.ops = &chrdev_dmabuf_ops;
+	exp_info.size = (size_t)npages << PAGE_SHIFT;
+	exp_info.flags = args.flags & (O_ACCMODE | O_CLOEXEC);	// O_RDONLY导出的fd不能PROT_WRITE映射
+	exp_info.priv = buf;
+	dmabuf = dma_buf_export(&exp_info);
+	if(IS_ERR(dmabuf))
+	{
+		rv = PTR_ERR(dmabuf);
+		goto put_pages;
+	}
+
+	/* 先把fd号写回用户，成功后才安装，失败时不会留下用户不知道的fd */
+	fd = get_unused_fd_flags(args.flags & O_CLOEXEC);
+	if(fd < 0)
+	{
+		dma_buf_put(dmabuf);	// release中释放buf和页
+		return fd;
+	}
+	if(put_user(fd, &uarg->fd))
+	{
+		put_unused_fd(fd);
+		dma_buf_put(dmabuf);
+		return -EFAULT;
+	}
+	fd_install(fd, dmabuf->file);
+
+	return 0;
+
+put_pages:
+	for(i = 0; i < npages; i++)
+		put_page(pages[i]);
+	kfree(buf);
+free_pages:
+	kvfree(pages);
+	return rv;
+}
+
+/* 导出fifo的数据区，不含控制页，布局与mmap偏移一页处相同 */
+static int ring_export_dmabuf(struct chrdev_dev *dev, struct chrdev_dmabuf_export __user *uarg)
+{
+	unsigned int	i, npages = dev->size >> PAGE_SHIFT;
+	struct page		**pages;
+
+	pages = kvmalloc_array(npages, sizeof(*pages), GFP_KERNEL);
+	if(!pages)
+		return -ENOMEM;
+
+	for(i = 0; i < npages; i++)
+		pages[i] = vmalloc_to_page(dev->data + ((size_t)i << PAGE_SHIFT));
+
+	return chrdev_dmabuf_export(pages, npages, uarg);
+}
+
+
+/*
+ *+------------------------------------------------------------------------------+ 
+ *|  实现对应的open/read/write等函数，填入file_operations结构体
+ *+------------------------------------------------------------------------------+
+ */
+/*
+ * read/readv都走read_iter：一次系统调用就把数据按iov_iter描述的分散缓冲区依次拷贝出去。
+ * IOCB_NOWAIT与O_NONBLOCK同样处理，方便aio/io_uring。
+ */
+static ssize_t chrtest_drv_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file				*file = iocb->ki_filp;
+	struct chrdev_dev		*dev = file->private_data;
+	struct chrdev_ring_ctrl	*ctrl = dev->ctrl;
+	bool					nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	u32						tail, off, len, first, copied;
+
+	if(!iov_iter_count(to))
+		return 0;
+
+	if(iocb->ki_flags & IOCB_NOWAIT)	// 连锁上的等待都不允许
+	{
+		if(!mutex_trylock(&dev->rlock))
+			return -EAGAIN;
+	}
+	else if(mutex_lock_interruptible(&dev->rlock))
+	{
+		return -ERESTARTSYS;
+	}
+
+	/* FIFO为空：非阻塞直接返回，阻塞则睡眠到写者放入数据 */
+	while(ring_empty(dev))
+	{
+		mutex_unlock(&dev->rlock);
+
+		if(nonblock)
+			return -EAGAIN;
+
+		WRITE_ONCE(ctrl->c_wait, 1);	// 告诉mmap的生产者：发布数据后需要KICK
+		smp_mb();
+		if(wait_event_interruptible(dev->r_wait, !ring_empty(dev)))
+			return -ERESTARTSYS;
+
+		if(mutex_lock_interruptible(&dev->rlock))
+			return -ERESTARTSYS;
+	}
+
+	/* 数据可能在缓冲区末尾回绕，分两段复制 */
+	len = min_t(size_t, ring_used(dev), iov_iter_count(to));
+	tail = READ_ONCE(ctrl->tail);
+	off = tail & (dev->size - 1);
+	first = min(len, dev->size - off);
+
+	copied = copy_to_iter(dev->data + off, first, to);	//内核空间的数据到用户空间上的复制
+	if(copied == first && len > first)
+		copied += copy_to_iter(dev->data, len - first, to);
+
+	if(copied)
+		smp_store_release(&ctrl->tail, tail + copied);	// 数据读完后才释放空间给生产者
+	mutex_unlock(&dev->rlock);
+
+	if(!copied)
+		return -EFAULT;
+
+	wake_up_interruptible(&dev->w_wait);	// 腾出了空间，唤醒等待的写者
+
+	return copied;
+}
+
+static ssize_t chrtest_drv_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file				*file = iocb->ki_filp;
+	struct chrdev_dev		*dev = file->private_data;
+	struct chrdev_ring_ctrl	*ctrl = dev->ctrl;
+	bool					nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	u32						head, off, len, first, copied;
+
+	if(!iov_iter_count(from))
+		return 0;
+
+	if(iocb->ki_flags & IOCB_NOWAIT)	// 连锁上的等待都不允许
+	{
+		if(!mutex_trylock(&dev->wlock))
+			return -EAGAIN;
+	}
+	else if(mutex_lock_interruptible(&dev->wlock))
+	{
+		return -ERESTARTSYS;
+	}
+
+	/* FIFO已满：非阻塞直接返回，阻塞则睡眠到读者取走数据 */
+	while(ring_full(dev))
+	{
+		mutex_unlock(&dev->wlock);
+
+		if(nonblock)
+			return -EAGAIN;
+
+		WRITE_ONCE(ctrl->p_wait, 1);	// 告诉mmap的消费者：释放空间后需要KICK
+		smp_mb();
+		if(wait_event_interruptible(dev->w_wait, !ring_full(dev)))
+			return -ERESTARTSYS;
+
+		if(mutex_lock_interruptible(&dev->wlock))
+			return -ERESTARTSYS;
+	}
+
+	/* writev的多个iovec在这里一次性追加到FIFO中 */
+	len = min_t(size_t, dev->size - ring_used(dev), iov_iter_count(from));
+	head = READ_ONCE(ctrl->head);
+	off = head & (dev->size - 1);
+	first = min(len, dev->size - off);
+
+	copied = copy_from_iter(dev->data + off, first, from);	//将用户数据追加到FIFO中,因为用户空间内存不能直接访问内核空间的内存
+	if(copied == first && len > first)
+		copied += copy_from_iter(dev->data, len - first, from);
+
+	if(copied)
+		smp_store_release(&ctrl->head, head + copied);	// 数据写完后才对消费者可见
+	mutex_unlock(&dev->wlock);
+
+	if(!copied)
+		return -EFAULT;
+
+	wake_up_interruptible(&dev->r_wait);	// 有新数据，唤醒等待的读者
+
+	return copied;
+}
+
+/* poll/select/epoll支持：FIFO非空可读，未满可写 */
+static __poll_t chrtest_drv_poll(struct file *file, poll_table *wait)
+{
+	struct chrdev_dev		*dev = file->private_data;
+	struct chrdev_ring_ctrl	*ctrl = dev->ctrl;
+	__poll_t				mask = 0;
+
+	poll_wait(file, &dev->r_wait, wait);
+	poll_wait(file, &dev->w_wait, wait);
+
+	/* 调用者即将睡眠，先置等待标志再复查，避免和mmap的对端错过唤醒 */
+	if(ring_empty(dev))
+	{
+		WRITE_ONCE(ctrl->c_wait, 1);
+		smp_mb();
+	}
+	if(ring_full(dev))
+	{
+		WRITE_ONCE(ctrl->p_wait, 1);
+		smp_mb();
+	}
+
+	if(!ring_empty(dev))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	if(!ring_full(dev))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+/* mmap：偏移0为控制页，偏移一页起为数据区，用户空间直接按head/tail协议收发，无需拷贝 */
+static int chrtest_drv_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct chrdev_dev	*dev = file->private_data;
+
+	return remap_vmalloc_range(vma, dev->ring_mem, vma->vm_pgoff);	// 内部会检查越界
+}
+
+static long chrtest_drv_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct chrdev_dev	*dev = file->private_data;
+
+	switch(cmd)
+	{
+		case CHRDEV_IOC_KICK:	// mmap的一端更新了下标，唤醒对端
+			WRITE_ONCE(dev->ctrl->c_wait, 0);
+			WRITE_ONCE(dev->ctrl->p_wait, 0);
+			wake_up_interruptible(&dev->r_wait);
+			wake_up_interruptible(&dev->w_wait);
+			break;
+		case CHRDEV_IOC_EXPORT_DMABUF:
+			return ring_export_dmabuf(dev, (struct chrdev_dmabuf_export __user *)arg);
+		default:
+			printk("%s driver don't support ioctl command=%d\n", DEV_NAME, cmd);
+			return -ENOTTY;
+	}
+	return 0;
+}
+
+//open和close函数
+
+static int chrtest_drv_open(struct inode *node, struct file *file)
+{
+	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
+
+	file->private_data = container_of(node->i_cdev, struct chrdev_dev, cdev);
+
+	return nonseekable_open(node, file);	// FIFO没有文件位置的概念
+}
+
+
+/*
+ * FIFO的read_iter/write_iter在IOCB_NOWAIT下既不睡眠也不等锁，标记FMODE_NOWAIT后
+ * io_uring会先在提交路径上直接尝试读写，-EAGAIN时再挂到poll上，数据到达时由
+ * r_wait/w_wait的唤醒触发完成，不必为每个请求占用一个io-wq内核线程。
+ */
+static int chrtest_fifo_open(struct inode *node, struct file *file)
+{
+	int		rv;
+
+	rv = chrtest_drv_open(node, file);
+	if(rv)
+		return rv;
+
+	file->f_mode |= FMODE_NOWAIT;
+
+	return 0;
+}
+
+
+static int chrtest_drv_close(struct inode *node, struct file *file)
+{
+	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
+	return 0;
+}
+
+
+/*
+ *+------------------------------------------------------------------------------+ 
+ *|  定义自己的file_operations结构体
+ *+------------------------------------------------------------------------------+
+ */
+static struct file_operations chrtest_fops =
+{
+	.owner		=	THIS_MODULE,
+	.open		=	chrtest_fifo_open,
+	.read_iter	=	chrtest_drv_read_iter,
+	.write_iter	=	chrtest_drv_write_iter,
+	.splice_read	=	generic_file_splice_read,	// 从环形缓冲区拷贝一次到pipe页，不经过用户空间
+	.splice_write	=	iter_file_splice_write,		// pipe页以bvec形式交给write_iter，只拷贝一次
+	.poll		=	chrtest_drv_poll,
+	.mmap		=	chrtest_drv_mmap,
+	.unlocked_ioctl	=	chrtest_drv_ioctl,
+	.llseek		=	no_llseek,
+	.release	=	chrtest_drv_close,
+}; 
+
+
+/*
+ *+------------------------------------------------------------------------------+ 
+ *|  blob模式：容量由blob_size指定，页在第一次写入或mmap缺页时才分配，
+ *|  支持llseek/pread/pwrite，dd/cat可以直接大块读写
+ *+------------------------------------------------------------------------------+
+ */
+static int blob_alloc(struct chrdev_dev *dev)
+{
+	dev->npages = DIV_ROUND_UP(blob_size, PAGE_SIZE);
+	if(dev->npages == 0)
+		return -EINVAL;
+
+	dev->pages = kvcalloc(dev->npages, sizeof(struct page *), GFP_KERNEL);	// 只分配页指针数组
+	if(!dev->pages)
+		return -ENOMEM;
+
+	atomic64_set(&dev->blob_len, 0);
+	return 0;
+}
+
+static void blob_free(struct chrdev_dev *dev)
+{
+	unsigned long	i;
+
+	for(i = 0; i < dev->npages; i++)
+	{
+		if(dev->pages[i])
+			put_page(dev->pages[i]);	// mmap仍持有引用的页会在munmap后才真正释放
+	}
+
+	kvfree(dev->pages);
+	dev->pages = NULL;
+}
+
+/* 获取第idx页，alloc为真时在第一次访问时分配一个清零的页；并发分配时用cmpxchg只保留一个 */
+static struct page *blob_page(struct chrdev_dev *dev, unsigned long idx, bool alloc)
+{
+	struct page		*page = READ_ONCE(dev->pages[idx]);
+
+	if(page || !alloc)
+		return page;
+
+	page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+	if(!page)
+		return NULL;
+	SetPageUptodate(page);	// splice把页直接挂进pipe时，pipe会检查页是否有效
+
+	if(cmpxchg(&dev->pages[idx], NULL, page) != NULL)
+	{
+		__free_page(page);
+		page = READ_ONCE(dev->pages[idx]);
+	}
+
+	return page;
+}
+
+/* 把blob_len推进到end，只增不减 */
+static void blob_extend(struct chrdev_dev *dev, loff_t end)
+{
+	s64		old = atomic64_read(&dev->blob_len);
+
+	while(old < end)
+	{
+		s64 prev = atomic64_cmpxchg(&dev->blob_len, old, end);
+		if(prev == old)
+			break;
+		old = prev;
+	}
+}
+
+static ssize_t chrtest_blob_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct chrdev_dev	*dev = iocb->ki_filp->private_data;
+	loff_t				pos = iocb->ki_pos;
+	loff_t				len = atomic64_read(&dev->blob_len);
+	size_t				size = iov_iter_count(to);
+	size_t				done = 0, n, off, copied;
+	struct page			*page;
+
+	if(pos < 0)
+		return -EINVAL;
+	if(pos >= len || !size)
+		return 0;	// EOF
+	size = min_t(loff_t, size, len - pos);
+
+	while(done < size)
+	{
+		off = pos & ~PAGE_MASK;
+		n = min_t(size_t, size - done, PAGE_SIZE - off);
+
+		/* 从未写过的页读出来是0，不需要为它分配内存 */
+		page = blob_page(dev, pos >> PAGE_SHIFT, false);
+		if(page)
+			copied = copy_page_to_iter(page, off, n, to);	// 内部处理高端内存的映射
+		else
+			copied = iov_iter_zero(n, to);
+
+		done += copied;
+		pos += copied;
+		if(copied < n)
+			break;
+	}
+
+	if(!done)
+		return -EFAULT;
+
+	iocb->ki_pos = pos;
+	return done;
+}
+
+static ssize_t chrtest_blob_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct chrdev_dev	*dev = iocb->ki_filp->private_data;
+	loff_t				pos = iocb->ki_pos;
+	loff_t				cap = (loff_t)dev->npages << PAGE_SHIFT;
+	size_t				size = iov_iter_count(from);
+	size_t				done = 0, n, off, copied;
+	struct page			*page;
+	ssize_t				rv = -EFAULT;
+
+	if(pos < 0)
+		return -EINVAL;
+	if(size == 0)
+		return 0;
+	if(pos >= cap)
+		return -ENOSPC;
+	size = min_t(loff_t, size, cap - pos);
+
+	while(done < size)
+	{
+		off = pos & ~PAGE_MASK;
+		n = min_t(size_t, size - done, PAGE_SIZE - off);
+
+		page = blob_page(dev, pos >> PAGE_SHIFT, true);	// 第一次写入时分配
+		if(!page)
+		{
+			rv = -ENOMEM;
+			break;
+		}
+
+		copied = copy_page_from_iter(page, off, n, from);
+
+		done += copied;
+		pos += copied;
+		if(copied < n)
+			break;
+	}
+
+	if(!done)
+		return rv;
+
+	blob_extend(dev, pos);
+	iocb->ki_pos = pos;
+	return done;
+}
+
+/* SEEK_END相对于已写入的长度，最大不能超过容量 */
+static loff_t chrtest_blob_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct chrdev_dev	*dev = file->private_data;
+
+	return generic_file_llseek_size(file, offset, whence,
+			(loff_t)dev->npages << PAGE_SHIFT, atomic64_read(&dev->blob_len));
+}
+
+/* mmap缺页处理：按需分配页并交给页表 */
+static vm_fault_t chrtest_blob_fault(struct vm_fault *vmf)
+{
+	struct chrdev_dev	*dev = vmf->vma->vm_private_data;
+	struct page			*page;
+
+	if(vmf->pgoff >= dev->npages)
+		return VM_FAULT_SIGBUS;
+
+	page = blob_page(dev, vmf->pgoff, true);
+	if(!page)
+		return VM_FAULT_OOM;
+
+	get_page(page);		// 页表持有一份引用
+	vmf->page = page;
+	return 0;
+}
+
+/*
+ * 有page_mkwrite时共享可写映射的页先以只读映射，第一次写入（包括先读后写）都会走到这里，
+ * 在这里推进blob_len，read/SEEK_END才能看到通过mmap写入的数据。
+ * 页没有address_space，返回0内核会认为页被截断而一直重试，所以自己锁页并返回VM_FAULT_LOCKED。
+ */
+static vm_fault_t chrtest_blob_page_mkwrite(struct vm_fault *vmf)
+{
+	struct chrdev_dev	*dev = vmf->vma->vm_private_data;
+
+	blob_extend(dev, min_t(loff_t, (loff_t)(vmf->pgoff + 1) << PAGE_SHIFT,
+				(loff_t)dev->npages << PAGE_SHIFT));
+
+	lock_page(vmf->page);
+	return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct chrtest_blob_vm_ops = {
+	.fault			=	chrtest_blob_fault,
+	.page_mkwrite	=	chrtest_blob_page_mkwrite,
+};
+
+static int chrtest_blob_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct chrdev_dev	*dev = file->private_data;
+
+	if(vma->vm_pgoff >= dev->npages || vma_pages(vma) > dev->npages - vma->vm_pgoff)
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_private_data = dev;
+	vma->vm_ops = &chrtest_blob_vm_ops;
+	return 0;
+}
+
+/*
+ * 只导出已写入的范围（按页向上取整）：其中没写过的空洞页补齐，容量剩下的部分保持不分配，
+ * blob_len不变，read/SEEK_END看到的长度和导出前一样。导入方写在最后一页blob_len之后的数据read不到。
+ */
+static int blob_export_dmabuf(struct chrdev_dev *dev, struct chrdev_dmabuf_export __user *uarg)
+{
+	struct page		**pages;
+	unsigned long	i, npages;
+
+	npages = DIV_ROUND_UP(atomic64_read(&dev->blob_len), PAGE_SIZE);
+	if(npages == 0)
+		return -ENODATA;	// 还没有写入任何数据
+	if(npages > UINT_MAX)
+		return -E2BIG;
+
+	pages = kvmalloc_array(npages, sizeof(*pages), GFP_KERNEL);
+	if(!pages)
+		return -ENOMEM;
+
+	for(i = 0; i < npages; i++)
+	{
+		pages[i] = blob_page(dev, i, true);
+		if(!pages[i])
+		{
+			kvfree(pages);
+			return -ENOMEM;
+		}
+	}
+
+	return chrdev_dmabuf_export(pages, npages, uarg);
+}
+
+static long chrtest_blob_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct chrdev_dev	*dev = file->private_data;
+
+	switch(cmd)
+	{
+		case CHRDEV_IOC_EXPORT_DMABUF:
+			return blob_export_dmabuf(dev, (struct chrdev_dmabuf_export __user *)arg);
+		default:
+			printk("%s driver don't support ioctl command=%d\n", DEV_NAME, cmd);
+			return -ENOTTY;
+	}
+}
+
+static int chrtest_blob_open(struct inode *node, struct file *file)
+{
+	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
+
+	file->private_data = container_of(node->i_cdev, struct chrdev_dev, cdev);
+
+	return 0;
+}
+
+static struct file_operations chrtest_blob_fops =
+{
+	.owner		=	THIS_MODULE,
+	.open		=	chrtest_blob_open,
+	.read_iter	=	chrtest_blob_read_iter,
+	.write_iter	=	chrtest_blob_write_iter,
+	.splice_read	=	generic_file_splice_read,	// copy_page_to_iter对pipe直接引用blob页，无需拷贝
+	.splice_write	=	iter_file_splice_write,
+	.mmap		=	chrtest_blob_mmap,
+	.unlocked_ioctl	=	chrtest_blob_ioctl,
+	.llseek		=	chrtest_blob_llseek,
+	.release	=	chrtest_drv_close,
+};
+
+
+/*
+ *+------------------------------------------------------------------------------+ 
+ *|  shard模式：每个CPU一个分片，写者拿当前CPU分片的锁追加记录，不和其他CPU的写者竞争；
+ *|  全局序号在数据拷贝完成后才分配，所以序号是连续的，读者按序号归并保证写入顺序
+ *+------------------------------------------------------------------------------+
+ */
+#define SHARD_REC_ALIGN		8
+
+static inline u32 shard_rec_bytes(u32 len)
+{
+	return ALIGN(sizeof(struct chrdev_shard_rec) + len, SHARD_REC_ALIGN);
+}
+
+static inline u32 shard_free_bytes(struct chrdev_shard *sh)
+{
+	return sh->size - (READ_ONCE(sh->head) - smp_load_acquire(&sh->tail));
+}
+
+/* 在分片的pos处读写n字节内核数据，处理回绕 */
+static void shard_put(struct chrdev_shard *sh, u32 pos, const void *src, u32 n)
+{
+	u32 off = pos & (sh->size - 1);
+	u32 first = min(n, sh->size - off);
+
+	memcpy(sh->data + off, src, first);
+	memcpy(sh->data, src + first, n - first);
+}
+
+static void shard_get(struct chrdev_shard *sh, u32 pos, void *dst, u32 n)
+{
+	u32 off = pos & (sh->size - 1);
+	u32 first = min(n, sh->size - off);
+
+	memcpy(dst, sh->data + off, first);
+	memcpy(dst + first, sh->data, n - first);
+}
+
+static int shard_alloc(struct chrdev_dev *dev)
+{
+	struct chrdev_shard	*sh;
+	unsigned int		size;
+	int					cpu;
+
+	if(fifo_size == 0 || fifo_size > (1U << 31))
+		return -EINVAL;
+	size = roundup_pow_of_two(max_t(unsigned int, fifo_size, PAGE_SIZE));
+
+	dev->shards = alloc_percpu(struct chrdev_shard);
+	if(!dev->shards)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+	{
+		sh = per_cpu_ptr(dev->shards, cpu);
+		mutex_init(&sh->lock);
+		init_waitqueue_head(&sh->w_wait);
+		sh->size = size;
+		sh->data = vmalloc_node(size, cpu_to_node(cpu));	// 分片放在该CPU所在的内存节点上
+		if(!sh->data)
+			goto undo_alloc;
+	}
+
+	atomic64_set(&dev->wseq, 0);
+	dev->rseq = 0;
+	return 0;
+
+undo_alloc:
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(dev->shards, cpu)->data);
+	free_percpu(dev->shards);
+	return -ENOMEM;
+}
+
+static void shard_free(struct chrdev_dev *dev)
+{
+	int		cpu;
+
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(dev->shards, cpu)->data);
+	free_percpu(dev->shards);
+	dev->shards = NULL;
+}
+
+/* 找到序号为rseq的记录所在的分片，没有（还没写入或还没发布）则返回NULL */
+static struct chrdev_shard *shard_next(struct chrdev_dev *dev, struct chrdev_shard_rec *rec)
+{
+	struct chrdev_shard	*sh;
+	u64					rseq = READ_ONCE(dev->rseq);
+	int					cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		sh = per_cpu_ptr(dev->shards, cpu);
+		if(smp_load_acquire(&sh->head) == sh->tail)
+			continue;
+
+		shard_get(sh, sh->tail, rec, sizeof(*rec));
+		if(rec->seq == rseq)
+			return sh;
+	}
+
+	return NULL;
+}
+
+static bool shard_readable(struct chrdev_dev *dev)
+{
+	struct chrdev_shard_rec rec;
+
+	return shard_next(dev, &rec) != NULL;
+}
+
+static ssize_t chrtest_shard_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file				*file = iocb->ki_filp;
+	struct chrdev_dev		*dev = file->private_data;
+	bool					nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	struct chrdev_shard		*sh;
+	struct chrdev_shard_rec	rec;
+	size_t					done = 0;
+	u32						pos, off, n, first, copied;
+
+	if(!iov_iter_count(to))
+		return 0;
+
+	if(mutex_lock_interruptible(&dev->rlock))
+		return -ERESTARTSYS;
+
+	while(iov_iter_count(to))
+	{
+		sh = shard_next(dev, &rec);
+		if(!sh)
+		{
+			if(done)
+				break;	// 已经读到数据就先返回
+
+			mutex_unlock(&dev->rlock);
+			if(nonblock)
+				return -EAGAIN;
+			if(wait_event_interruptible(dev->r_wait, shard_readable(dev)))
+				return -ERESTARTSYS;
+			if(mutex_lock_interruptible(&dev->rlock))
+				return -ERESTARTSYS;
+			continue;
+		}
+
+		/* 用户缓冲区可能装不下整条记录，rec_off记录读到了哪里 */
+		pos = sh->tail + sizeof(rec) + sh->rec_off;
+		n = min_t(size_t, rec.len - sh->rec_off, iov_iter_count(to));
+		off = pos & (sh->size - 1);
+		first = min(n, sh->size - off);
+		copied = copy_to_iter(sh->data + off, first, to);
+		if(copied == first && n > first)
+			copied += copy_to_iter(sh->data, n - first, to);
+
+		done += copied;
+		sh->rec_off += copied;
+		if(sh->rec_off == rec.len)
+		{
+			sh->rec_off = 0;
+			smp_store_release(&sh->tail, sh->tail + shard_rec_bytes(rec.len));
+			WRITE_ONCE(dev->rseq, dev->rseq + 1);
+			wake_up_interruptible(&sh->w_wait);
+		}
+
+		if(copied < n)
+			break;
+	}
+	mutex_unlock(&dev->rlock);
+
+	return done ? done : -EFAULT;
+}
+
+static ssize_t chrtest_shard_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file				*file = iocb->ki_filp;
+	struct chrdev_dev		*dev = file->private_data;
+	bool					nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	struct chrdev_shard		*sh;
+	struct chrdev_shard_rec	rec = { 0 };
+	u32						head, pos, off, first, len, copied;
+
+	if(!iov_iter_count(from))
+		return 0;
+
+	/* 只锁当前CPU的分片；之后即使被迁移到别的CPU也继续用这个分片，正确性不受影响 */
+	sh = per_cpu_ptr(dev->shards, raw_smp_processor_id());
+
+	/* 一条记录最多占分片的一半，超出部分由调用者再次write */
+	len = min_t(size_t, iov_iter_count(from), sh->size / 2 - sizeof(rec));
+
+	if(iocb->ki_flags & IOCB_NOWAIT)
+	{
+		if(!mutex_trylock(&sh->lock))
+			return -EAGAIN;
+	}
+	else if(mutex_lock_interruptible(&sh->lock))
+	{
+		return -ERESTARTSYS;
+	}
+
+	while(shard_free_bytes(sh) < shard_rec_bytes(len))
+	{
+		mutex_unlock(&sh->lock);
+
+		if(nonblock)
+			return -EAGAIN;
+		if(wait_event_interruptible(sh->w_wait, shard_free_bytes(sh) >= shard_rec_bytes(len)))
+			return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&sh->lock))
+			return -ERESTARTSYS;
+	}
+
+	/* 先把数据拷进未发布的空间，拷贝成功后再分配序号，保证序号连续 */
+	head = sh->head;
+	pos = head + sizeof(rec);
+	off = pos & (sh->size - 1);
+	first = min(len, sh->size - off);
+	copied = copy_from_iter(sh->data + off, first, from);
+	if(copied == first && len > first)
+		copied += copy_from_iter(sh->data, len - first, from);
+
+	if(!copied)
+	{
+		mutex_unlock(&sh->lock);
+		return -EFAULT;
+	}
+
+	rec.len = copied;
+	rec.seq = atomic64_inc_return(&dev->wseq) - 1;
+	shard_put(sh, head, &rec, sizeof(rec));
+	smp_store_release(&sh->head, head + shard_rec_bytes(copied));	// 记录完整后才对读者可见
+	mutex_unlock(&sh->lock);
+
+	wake_up_interruptible(&dev->r_wait);
+
+	return copied;
+}
+
+/* 有序号连续的下一条记录才可读；当前CPU的分片有空间即可写 */
+static __poll_t chrtest_shard_poll(struct file *file, poll_table *wait)
+{
+	struct chrdev_dev	*dev = file->private_data;
+	struct chrdev_shard	*sh = per_cpu_ptr(dev->shards, raw_smp_processor_id());
+	__poll_t			mask = 0;
+
+	poll_wait(file, &dev->r_wait, wait);
+	poll_wait(file, &sh->w_wait, wait);
+
+	if(shard_readable(dev))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	if(shard_free_bytes(sh) >= shard_rec_bytes(1))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static struct file_operations chrtest_shard_fops =
+{
+	.owner		=	THIS_MODULE,
+	.open		=	chrtest_drv_open,
+	.read_iter	=	chrtest_shard_read_iter,
+	.write_iter	=	chrtest_shard_write_iter,
+	.poll		=	chrtest_shard_poll,
+	.llseek		=	no_llseek,
+	.release	=	chrtest_drv_close,
+};
+
+
+/*
+ *+------------------------------------------------------------------------------+ 
+ *|  snapshot模式：每次write整体替换为一个新版本，用RCU发布；
+ *|  读者不加锁，在偏移0处固定住最新版本，之后的read都来自这个版本，保证读到的内容完整一致
+ *+------------------------------------------------------------------------------+
+ */
+static void snap_free_rcu(struct rcu_head *rcu)
+{
+	kvfree(container_of(rcu, struct chrdev_snap, rcu));
+}
+
+static void snap_release(struct kref *ref)
+{
+	struct chrdev_snap *snap = container_of(ref, struct chrdev_snap, ref);
+
+	/* 可能还有读者刚在RCU临界区里取到这个指针，正在尝试kref_get_unless_zero，所以等宽限期后再释放 */
+	call_rcu(&snap->rcu, snap_free_rcu);
+}
+
+static void snap_put(struct chrdev_snap *snap)
+{
+	if(snap)
+		kref_put(&snap->ref, snap_release);
+}
+
+/* 取得当前发布版本的一份引用，全程不加锁，不会阻塞写者 */
+static struct chrdev_snap *snap_get_latest(struct chrdev_dev *dev)
+{
+	struct chrdev_snap	*snap;
+
+	rcu_read_lock();
+	do {
+		snap = rcu_dereference(dev->snap);
+	} while(snap && !kref_get_unless_zero(&snap->ref));	// 引用归零说明已被替换，重新取
+	rcu_read_unlock();
+
+	return snap;
+}
+
+/* 最新版本号直接从发布的版本里取，不需要额外的同步 */
+static u64 snap_latest_version(struct chrdev_dev *dev)
+{
+	struct chrdev_snap	*snap;
+	u64					version;
+
+	rcu_read_lock();
+	snap = rcu_dereference(dev->snap);
+	version = snap ? snap->version : 0;
+	rcu_read_unlock();
+
+	return version;
+}
+
+static int snap_alloc(struct chrdev_dev *dev)
+{
+	RCU_INIT_POINTER(dev->snap, NULL);	// 版本0：空
+	dev->snap_version = 0;
+	return 0;
+}
+
+static void snap_free(struct chrdev_dev *dev)
+{
+	snap_put(rcu_dereference_protected(dev->snap, 1));
+	RCU_INIT_POINTER(dev->snap, NULL);
+	rcu_barrier();	// 等call_rcu回调都执行完，模块才能卸载
+}
+
+static int chrtest_snap_open(struct inode *node, struct file *file)
+{
+	struct chrdev_snap_file	*sf;
+
+	sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if(!sf)
+		return -ENOMEM;
+
+	sf->dev = container_of(node->i_cdev, struct chrdev_dev, cdev);
+	spin_lock_init(&sf->lock);
+	file->private_data = sf;
 
-static struct class *chrdev_class;	//定义一个class用于自动创建类
+	return 0;
+}
+
+static int chrtest_snap_release(struct inode *node, struct file *file)
+{
+	struct chrdev_snap_file	*sf = file->private_data;
+
+	snap_put(sf->snap);
+	kfree(sf);
+	return 0;
+}
+
+/* 取得本文件正在读的版本的引用；从偏移0开始读时先换成最新版本 */
+static struct chrdev_snap *snap_file_get(struct chrdev_snap_file *sf, bool latest)
+{
+	struct chrdev_snap	*snap, *old = NULL;
+
+	if(latest)
+	{
+		snap = snap_get_latest(sf->dev);
+		spin_lock(&sf->lock);
+		old = sf->snap;
+		sf->snap = snap;
+		if(snap)
+			kref_get(&snap->ref);	// 一份给sf，一份给调用者
+		spin_unlock(&sf->lock);
+		snap_put(old);
+		return snap;
+	}
+
+	spin_lock(&sf->lock);
+	snap = sf->snap;
+	if(snap)
+		kref_get(&snap->ref);
+	spin_unlock(&sf->lock);
+
+	return snap;
+}
+
+static ssize_t chrtest_snap_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct chrdev_snap_file	*sf = iocb->ki_filp->private_data;
+	struct chrdev_snap		*snap;
+	loff_t					pos = iocb->ki_pos;
+	size_t					n, copied;
+
+	if(pos < 0)
+		return -EINVAL;
+
+	snap = snap_file_get(sf, pos == 0);
+	if(!snap || pos >= snap->len)
+	{
+		snap_put(snap);
+		return 0;	// EOF
+	}
+
+	n = min_t(loff_t, iov_iter_count(to), snap->len - pos);
+	copied = copy_to_iter(snap->data + pos, n, to);	// 持有引用，拷贝时可以睡眠
+	snap_put(snap);
+
+	if(!copied && n)
+		return -EFAULT;
+
+	iocb->ki_pos = pos + copied;
+	return copied;
+}
+
+/* 每次write都生成一个完整的新版本，写者之间用wlock串行，读者不受影响 */
+static ssize_t chrtest_snap_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct chrdev_dev	*dev = ((struct chrdev_snap_file *)iocb->ki_filp->private_data)->dev;
+	struct chrdev_snap	*snap, *old;
+	size_t				len = iov_iter_count(from);
+
+	if(len > fifo_size)
+		return -EFBIG;
+
+	snap = kvmalloc(struct_size(snap, data, len), GFP_KERNEL);
+	if(!snap)
+		return -ENOMEM;
+
+	if(copy_from_iter(snap->data, len, from) != len)
+	{
+		kvfree(snap);
+		return -EFAULT;
+	}
+	snap->len = len;
+	kref_init(&snap->ref);
+
+	if(mutex_lock_interruptible(&dev->wlock))
+	{
+		kvfree(snap);
+		return -ERESTARTSYS;
+	}
+	snap->version = ++dev->snap_version;
+	old = rcu_dereference_protected(dev->snap, lockdep_is_held(&dev->wlock));
+	rcu_assign_pointer(dev->snap, snap);	// 内容和版本号填好后才发布
+	mutex_unlock(&dev->wlock);
+
+	snap_put(old);	// 去掉发布指针那份引用，还在读旧版本的读者不受影响
+	wake_up_interruptible(&dev->r_wait);
+
+	return len;
+}
+
+/* SEEK_END相对于本文件固定住的版本的长度 */
+static loff_t chrtest_snap_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct chrdev_snap_file	*sf = file->private_data;
+	struct chrdev_snap		*snap = snap_file_get(sf, false);
+	loff_t					rv;
+
+	rv = generic_file_llseek_size(file, offset, whence, MAX_LFS_FILESIZE, snap ? snap->len : 0);
+	snap_put(snap);
+
+	return rv;
+}
+
+/* 有比本文件正在读的版本更新的版本时可读，读者可以poll等待配置更新 */
+static __poll_t chrtest_snap_poll(struct file *file, poll_table *wait)
+{
+	struct chrdev_snap_file	*sf = file->private_data;
+	struct chrdev_snap		*snap;
+	u64						seen;
+	__poll_t				mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(file, &sf->dev->r_wait, wait);
 
-static char kernel_buf[1024];
+	snap = snap_file_get(sf, false);
+	seen = snap ? snap->version : 0;
+	snap_put(snap);
 
-#define MIN(a, b) (a < b ? a : b)
+	if(snap_latest_version(sf->dev) != seen)
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	return mask;
+}
+
+static long chrtest_snap_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct chrdev_snap_file	*sf = file->private_data;
+	struct chrdev_snap		*snap;
+	u64						version;
+
+	switch(cmd)
+	{
+		case CHRDEV_IOC_SNAP_VERSION:
+			/* 返回本文件固定住的版本，即刚才read到的数据的版本；还没读过为0 */
+			snap = snap_file_get(sf, false);
+			version = snap ? snap->version : 0;
+			snap_put(snap);
+			return put_user(version, (__u64 __user *)arg);
+		default:
+			printk("%s driver don't support ioctl command=%d\n", DEV_NAME, cmd);
+			return -ENOTTY;
+	}
+}
+
+static struct file_operations chrtest_snap_fops =
+{
+	.owner		=	THIS_MODULE,
+	.open		=	chrtest_snap_open,
+	.read_iter	=	chrtest_snap_read_iter,
+	.write_iter	=	chrtest_snap_write_iter,
+	.poll		=	chrtest_snap_poll,
+	.unlocked_ioctl	=	chrtest_snap_ioctl,
+	.llseek		=	chrtest_snap_llseek,
+	.release	=	chrtest_snap_release,
+};
 
 
 /*
  *+------------------------------------------------------------------------------+ 
- *|  实现对应的open/read/write等函数，填入file_operations结构体
+ *|  log模式：写者往有界的环形日志里追加消息，空间不够时直接覆盖最老的消息，从不等待读者；
+ *|  每个读者在自己的file里记录读位置，被覆盖的读者下一次read得到-EPIPE并跳到最老的消息
  *+------------------------------------------------------------------------------+
  */
-static ssize_t chrtest_drv_read(struct file *file, char __user *buf, size_t size, loff_t *offset)
+/* 一致地读出最早位置和写入位置 */
+static void log_bounds(struct chrdev_dev *dev, u64 *start, u64 *head)
 {
-	int		err;
-	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
-	err = copy_to_user(buf, kernel_buf, MIN(1024, size));	//内核空间的数据到用户空间上的复制
-	return MIN(1024, size);
+	unsigned int	seq;
+
+	do {
+		seq = read_seqcount_begin(&dev->log_seq);
+		*start = dev->log_start;
+		*head = dev->log_head;
+	} while(read_seqcount_retry(&dev->log_seq, seq));
 }
 
-static ssize_t chrtest_drv_write(struct file *file, const char __user *buf, size_t size,loff_t *offset)
+static void log_set_bounds(struct chrdev_dev *dev, u64 start, u64 head)
 {
-	int		err;
-	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
-	err = copy_from_user(kernel_buf, buf,  MIN(1024,size));		//将buf中的数据复制到写缓存区kernel_buf中,因为用户空间内存不能直接访问内核空间的内存
-	return MIN(1024, size);
+	preempt_disable();
+	write_seqcount_begin(&dev->log_seq);
+	dev->log_start = start;
+	dev->log_head = head;
+	write_seqcount_end(&dev->log_seq);
+	preempt_enable();
 }
 
-//open和close函数
+static int log_alloc(struct chrdev_dev *dev)
+{
+	if(fifo_size == 0 || fifo_size > (1U << 31))
+		return -EINVAL;
 
-static int chrtest_drv_open(struct inode *node, struct file *file)
+	dev->size = roundup_pow_of_two(max_t(unsigned int, fifo_size, PAGE_SIZE));
+	dev->data = vmalloc(dev->size);
+	if(!dev->data)
+		return -ENOMEM;
+
+	seqcount_init(&dev->log_seq);
+	dev->log_start = 0;
+	dev->log_head = 0;
+	return 0;
+}
+
+static void log_free(struct chrdev_dev *dev)
 {
-	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
+	vfree(dev->data);
+	dev->data = NULL;
+}
+
+static bool log_readable(struct chrdev_log_file *lf)
+{
+	u64		start, head;
+
+	log_bounds(lf->dev, &start, &head);
+	return READ_ONCE(lf->pos) != head;
+}
+
+static int chrtest_log_open(struct inode *node, struct file *file)
+{
+	struct chrdev_log_file	*lf;
+	u64						start;
+
+	lf = kzalloc(sizeof(*lf), GFP_KERNEL);
+	if(!lf)
+		return -ENOMEM;
+
+	lf->dev = container_of(node->i_cdev, struct chrdev_dev, cdev);
+	mutex_init(&lf->lock);
+	log_bounds(lf->dev, &start, &lf->pos);	// 新读者从下一条消息开始读，lseek到0可回看保留的历史
+	file->private_data = lf;
+
 	return 0;
 }
 
+static int chrtest_log_release(struct inode *node, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
 
-static int chrtest_drv_close(struct inode *node, struct file *file)
+/* 每次read返回一条完整消息；被写者覆盖时返回-EPIPE，读位置跳到最老的消息 */
+static ssize_t chrtest_log_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
+	struct file				*file = iocb->ki_filp;
+	struct chrdev_log_file	*lf = file->private_data;
+	struct chrdev_dev		*dev = lf->dev;
+	bool					nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	struct chrdev_msg_hdr	rec;
+	u64						start, head, pos;
+	u32						len, off, first, copied;
+	ssize_t					rv;
+
+	if(mutex_lock_interruptible(&lf->lock))
+		return -ERESTARTSYS;
+
+	log_bounds(dev, &start, &head);
+	while(lf->pos == head)
+	{
+		mutex_unlock(&lf->lock);
+		if(nonblock)
+			return -EAGAIN;
+		if(wait_event_interruptible(dev->r_wait, log_readable(lf)))
+			return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&lf->lock))
+			return -ERESTARTSYS;
+		log_bounds(dev, &start, &head);
+	}
+
+	pos = lf->pos;
+	if(pos < start)
+	{
+		rv = -EPIPE;	// 读得太慢，中间的消息已被覆盖
+		goto overrun;
+	}
+
+	/* 不持锁直接拷贝，拷完再检查这段数据在拷贝期间有没有被覆盖 */
+	ring_get(dev, pos, &rec, sizeof(rec));
+	len = min_t(u32, rec.len, dev->size / 2);
+	if(len > iov_iter_count(to))
+	{
+		smp_rmb();
+		log_bounds(dev, &start, &head);
+		if(pos < start)	// 读到的消息头可能已被覆盖
+		{
+			rv = -EPIPE;
+			goto overrun;
+		}
+		rv = -EINVAL;	// 和/dev/kmsg一样，缓冲区必须能放下整条消息
+		goto out;
+	}
+
+	off = (u32)(pos + sizeof(rec)) & (dev->size - 1);
+	first = min(len, dev->size - off);
+	copied = copy_to_iter(dev->data + off, first, to);
+	if(copied == first && len > first)
+		copied += copy_to_iter(dev->data, len - first, to);
+
+	smp_rmb();
+	log_bounds(dev, &start, &head);
+	if(pos < start)
+	{
+		rv = -EPIPE;
+		goto overrun;
+	}
+	if(copied != len)
+	{
+		rv = -EFAULT;
+		goto out;
+	}
+
+	lf->pos = pos + msg_bytes(len);
+	rv = len;
+	goto out;
+
+overrun:
+	lf->pos = start;
+out:
+	mutex_unlock(&lf->lock);
+	return rv;
+}
+
+/* 每次write追加一条消息，写者之间用wlock串行；空间不够就淘汰最老的消息，不等待任何读者 */
+static ssize_t chrtest_log_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct chrdev_dev		*dev = ((struct chrdev_log_file *)iocb->ki_filp->private_data)->dev;
+	struct chrdev_msg_hdr	rec = { 0 };
+	size_t					len = iov_iter_count(from);
+	u64						start, head;
+	u32						need, off, first, copied;
+
+	if(len == 0)
+		return 0;	// 空记录读出来和EOF无法区分，和dgram一样不入队
+	if(len > dev->size / 2 - sizeof(rec))
+		return -EMSGSIZE;
+	need = msg_bytes(len);
+
+	if(mutex_lock_interruptible(&dev->wlock))
+		return -ERESTARTSYS;
+
+	/* 先推进最早位置腾出空间并发布，之后读者就知道这段数据即将被覆盖 */
+	start = dev->log_start;
+	head = dev->log_head;
+	while(head + need - start > dev->size)
+	{
+		struct chrdev_msg_hdr old;
+
+		ring_get(dev, start, &old, sizeof(old));
+		start += msg_bytes(old.len);
+	}
+	log_set_bounds(dev, start, head);
+	smp_wmb();
+
+	off = (u32)(head + sizeof(rec)) & (dev->size - 1);
+	first = min_t(u32, len, dev->size - off);
+	copied = copy_from_iter(dev->data + off, first, from);
+	if(copied == first && len > first)
+		copied += copy_from_iter(dev->data, len - first, from);
+	if(copied != len)
+	{
+		mutex_unlock(&dev->wlock);
+		return -EFAULT;
+	}
+
+	rec.len = len;
+	ring_put(dev, head, &rec, sizeof(rec));
+	smp_wmb();
+	log_set_bounds(dev, start, head + need);	// 消息写完整后才对读者可见
+	mutex_unlock(&dev->wlock);
+
+	wake_up_interruptible(&dev->r_wait);	// 唤醒所有读者
+
+	return len;
+}
+
+/* SEEK_SET 0回到最老的消息，SEEK_END 0跳到最新位置 */
+static loff_t chrtest_log_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct chrdev_log_file	*lf = file->private_data;
+	u64						start, head;
+
+	if(offset != 0)
+		return -EINVAL;
+
+	mutex_lock(&lf->lock);
+	log_bounds(lf->dev, &start, &head);
+	switch(whence)
+	{
+		case SEEK_SET:
+			lf->pos = start;
+			break;
+		case SEEK_END:
+			lf->pos = head;
+			break;
+		default:
+			mutex_unlock(&lf->lock);
+			return -EINVAL;
+	}
+	mutex_unlock(&lf->lock);
+
 	return 0;
 }
 
+static __poll_t chrtest_log_poll(struct file *file, poll_table *wait)
+{
+	struct chrdev_log_file	*lf = file->private_data;
+	__poll_t				mask = EPOLLOUT | EPOLLWRNORM;	// 写者从不阻塞
+
+	poll_wait(file, &lf->dev->r_wait, wait);
+
+	if(log_readable(lf))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	return mask;
+}
+
+static struct file_operations chrtest_log_fops =
+{
+	.owner		=	THIS_MODULE,
+	.open		=	chrtest_log_open,
+	.read_iter	=	chrtest_log_read_iter,
+	.write_iter	=	chrtest_log_write_iter,
+	.poll		=	chrtest_log_poll,
+	.llseek		=	chrtest_log_llseek,
+	.release	=	chrtest_log_release,
+};
+
 
 /*
  *+------------------------------------------------------------------------------+ 
- *|  定义自己的file_operations结构体
+ *|  dgram模式：复用FIFO的环形缓冲区，但每条消息带长度头，一次write入队一条消息，
+ *|  一次read出队一条消息；CHRDEV_IOC_RECVMMSG一次系统调用取出多条消息
  *+------------------------------------------------------------------------------+
  */
-static struct file_operations chrtest_fops =
+static inline bool dgram_has_room(struct chrdev_dev *dev, u32 need)
+{
+	return dev->size - ring_used(dev) >= need;
+}
+
+/* 等到队列里至少有一条消息，成功时返回0并持有rlock */
+static int dgram_wait_msg(struct chrdev_dev *dev, bool nonblock)
+{
+	if(mutex_lock_interruptible(&dev->rlock))
+		return -ERESTARTSYS;
+
+	while(ring_empty(dev))
+	{
+		mutex_unlock(&dev->rlock);
+		if(nonblock)
+			return -EAGAIN;
+		if(wait_event_interruptible(dev->r_wait, !ring_empty(dev)))
+			return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&dev->rlock))
+			return -ERESTARTSYS;
+	}
+
+	return 0;
+}
+
+/*
+ * 持有rlock且队列非空时取出一条消息拷贝到to，返回拷贝的字节数，*len返回消息实际长度。
+ * 缓冲区放不下时截断，剩余部分丢弃；拷贝出错时消息保留在队列中。
+ */
+static ssize_t dgram_recv_one(struct chrdev_dev *dev, struct iov_iter *to, u32 *len)
+{
+	struct chrdev_ring_ctrl	*ctrl = dev->ctrl;
+	struct chrdev_msg_hdr	hdr;
+	u32						tail, off, first, n, copied;
+
+	tail = READ_ONCE(ctrl->tail);
+	ring_get(dev, tail, &hdr, sizeof(hdr));
+	*len = min_t(u32, hdr.len, dev->size - sizeof(hdr));
+
+	n = min_t(size_t, *len, iov_iter_count(to));
+	off = (tail + sizeof(hdr)) & (dev->size - 1);
+	first = min(n, dev->size - off);
+	copied = copy_to_iter(dev->data + off, first, to);
+	if(copied == first && n > first)
+		copied += copy_to_iter(dev->data, n - first, to);
+	if(copied != n)
+		return -EFAULT;
+
+	smp_store_release(&ctrl->tail, tail + msg_bytes(*len));
+	return n;
+}
+
+static ssize_t chrtest_dgram_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file			*file = iocb->ki_filp;
+	struct chrdev_dev	*dev = file->private_data;
+	bool				nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	ssize_t				rv;
+	u32					len;
+
+	rv = dgram_wait_msg(dev, nonblock);
+	if(rv)
+		return rv;
+
+	rv = dgram_recv_one(dev, to, &len);
+	mutex_unlock(&dev->rlock);
+
+	if(rv >= 0)
+		wake_up_interruptible(&dev->w_wait);
+
+	return rv;
+}
+
+/* 一次write入队一条完整的消息，空间不够时整条等待，不会拆开 */
+static ssize_t chrtest_dgram_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file				*file = iocb->ki_filp;
+	struct chrdev_dev		*dev = file->private_data;
+	struct chrdev_ring_ctrl	*ctrl = dev->ctrl;
+	bool					nonblock = (file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	struct chrdev_msg_hdr	hdr = { 0 };
+	size_t					len = iov_iter_count(from);
+	u32						need, head, off, first, copied;
+
+	if(len == 0)
+		return 0;	// 空消息读出来和EOF无法区分，和FIFO一样不入队
+	if(len > dev->size - sizeof(hdr))
+		return -EMSGSIZE;
+	need = msg_bytes(len);
+
+	if(mutex_lock_interruptible(&dev->wlock))
+		return -ERESTARTSYS;
+
+	while(!dgram_has_room(dev, need))
+	{
+		mutex_unlock(&dev->wlock);
+		if(nonblock)
+			return -EAGAIN;
+		if(wait_event_interruptible(dev->w_wait, dgram_has_room(dev, need)))
+			return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&dev->wlock))
+			return -ERESTARTSYS;
+	}
+
+	head = READ_ONCE(ctrl->head);
+	off = (head + sizeof(hdr)) & (dev->size - 1);
+	first = min_t(u32, len, dev->size - off);
+	copied = copy_from_iter(dev->data + off, first, from);
+	if(copied == first && len > first)
+		copied += copy_from_iter(dev->data, len - first, from);
+	if(copied != len)
+	{
+		mutex_unlock(&dev->wlock);
+		return -EFAULT;
+	}
+
+	hdr.len = len;
+	ring_put(dev, head, &hdr, sizeof(hdr));
+	smp_store_release(&ctrl->head, head + need);	// 整条消息写完后才对读者可见
+	mutex_unlock(&dev->wlock);
+
+	wake_up_interruptible(&dev->r_wait);
+
+	return len;
+}
+
+/* 一次取出多条消息，每条消息的长度和截断标志写回用户的chrdev_msg数组 */
+static long dgram_recvmmsg(struct file *file, struct chrdev_mmsg __user *umm)
+{
+	struct chrdev_dev	*dev = file->private_data;
+	struct chrdev_mmsg	mm;
+	struct chrdev_msg	msg;
+	struct chrdev_msg __user *umsg;
+	struct iovec		iov;
+	struct iov_iter		iter;
+	unsigned int		cnt = 0;
+	long				rv;
+	u32					len;
+
+	if(copy_from_user(&mm, umm, sizeof(mm)))
+		return -EFAULT;
+	if(mm.vlen == 0)
+		return 0;
+	mm.vlen = min_t(u32, mm.vlen, CHRDEV_MMSG_MAX);
+	umsg = u64_to_user_ptr(mm.msgs);
+
+	rv = dgram_wait_msg(dev, (file->f_flags & O_NONBLOCK) || (mm.flags & CHRDEV_MMSG_DONTWAIT));
+	if(rv)
+		return rv;
+
+	while(cnt < mm.vlen && !ring_empty(dev))
+	{
+		if(copy_from_user(&msg, &umsg[cnt], sizeof(msg)))
+		{
+			rv = -EFAULT;
+			break;
+		}
+
+		rv = import_single_range(READ, u64_to_user_ptr(msg.buf), msg.len, &iov, &iter);
+		if(rv)
+			break;
+
+		rv = dgram_recv_one(dev, &iter, &len);
+		if(rv < 0)
+			break;
+
+		msg.flags = (rv < len) ? CHRDEV_MSG_TRUNC : 0;
+		msg.len = len;
+		cnt++;	// 消息已出队，即使写回失败也计入
+		if(copy_to_user(&umsg[cnt - 1], &msg, sizeof(msg)))
+		{
+			rv = -EFAULT;
+			break;
+		}
+	}
+	mutex_unlock(&dev->rlock);
+
+	if(cnt)
+		wake_up_interruptible(&dev->w_wait);	// 整批只唤醒一次
+
+	return cnt ? cnt : rv;
+}
+
+static long chrtest_dgram_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	switch(cmd)
+	{
+		case CHRDEV_IOC_RECVMMSG:
+			return dgram_recvmmsg(file, (struct chrdev_mmsg __user *)arg);
+		default:
+			printk("%s driver don't support ioctl command=%d\n", DEV_NAME, cmd);
+			return -ENOTTY;
+	}
+}
+
+static __poll_t chrtest_dgram_poll(struct file *file, poll_table *wait)
+{
+	struct chrdev_dev	*dev = file->private_data;
+	__poll_t			mask = 0;
+
+	poll_wait(file, &dev->r_wait, wait);
+	poll_wait(file, &dev->w_wait, wait);
+
+	if(!ring_empty(dev))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	if(dgram_has_room(dev, msg_bytes(1)))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static struct file_operations chrtest_dgram_fops =
 {
 	.owner		=	THIS_MODULE,
 	.open		=	chrtest_drv_open,
-	.read		=	chrtest_drv_read,
-	.write		=	chrtest_drv_write,
+	.read_iter	=	chrtest_dgram_read_iter,
+	.write_iter	=	chrtest_dgram_write_iter,
+	.poll		=	chrtest_dgram_poll,
+	.unlocked_ioctl	=	chrtest_dgram_ioctl,
+	.llseek		=	no_llseek,
 	.release	=	chrtest_drv_close,
-}; 
+};
+
+
+static const struct chrdev_mode chrdev_modes[] = {
+	{ .name = "fifo",	.fops = &chrtest_fops,		.alloc = ring_alloc,	.free = ring_free },
+	{ .name = "blob",	.fops = &chrtest_blob_fops,	.alloc = blob_alloc,	.free = blob_free },
+	{ .name = "shard",	.fops = &chrtest_shard_fops,	.alloc = shard_alloc,	.free = shard_free },
+	{ .name = "snapshot",	.fops = &chrtest_snap_fops,	.alloc = snap_alloc,	.free = snap_free },
+	{ .name = "log",	.fops = &chrtest_log_fops,		.alloc = log_alloc,	.free = log_free },
+	{ .name = "dgram",	.fops = &chrtest_dgram_fops,	.alloc = ring_alloc,	.free = ring_free },
+};
+
+
+/* 初始化第minor个设备：分配缓冲区、锁和等待队列，注册cdev并创建/dev/chrdevN */
+static int chrdev_setup(struct chrdev_dev *dev, int minor)
+{
+	struct device	*device;
+	dev_t			devno = MKDEV(dev_major, minor);
+	int				result;
+
+	result = chrdev_mode->alloc(dev);
+	if(result != 0)
+	{
+		printk(KERN_ERR " %s%d driver can't alloc %s buffer\n", DEV_NAME, minor, chrdev_mode->name);
+		return result;
+	}
+	mutex_init(&dev->rlock);
+	mutex_init(&dev->wlock);
+	init_waitqueue_head(&dev->r_wait);
+	init_waitqueue_head(&dev->w_wait);
+
+	// 初始化cdev结构体，绑定主次设备号、fops到cdev结构体中，并注册给Linux内核
+	cdev_init(&dev->cdev, chrdev_mode->fops);	//初始化设备
+	dev->cdev.owner = THIS_MODULE;	//.owner表示是谁拥有你这个驱动程序
+	result = cdev_add(&dev->cdev, devno, 1);	//将字符设备注册进内核
+	if(result != 0)
+	{
+		printk(KERN_INFO " %s%d driver can't register cdev:result=%d\n", DEV_NAME, minor, result);
+		goto undo_buf;
+	}
+
+	device = device_create(chrdev_class, NULL, devno, NULL, DEV_NAME "%d", minor); // /dev/chrdevN 注册这个设备节点
+	if(IS_ERR(device))
+	{
+		result = PTR_ERR(device);
+		goto undo_cdev;
+	}
+
+	return 0;
+
+undo_cdev:
+	cdev_del(&dev->cdev);
+undo_buf:
+	chrdev_mode->free(dev);
+	return result;
+}
+
+static void chrdev_teardown(struct chrdev_dev *dev, int minor)
+{
+	device_destroy(chrdev_class, MKDEV(dev_major, minor));	//注销这个设备节点
+	cdev_del(&dev->cdev);	//注销字符设备
+	chrdev_mode->free(dev);	//释放缓冲区
+}
 
 
 /*
@@ -108,19 +2170,38 @@ static struct file_operations chrtest_fops =
 static int __init chrdev_init(void)
 {
 	int		result;
+	int		i;
 	dev_t	devno;	//定义一个dev_t的变量表示设备号
 
 	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
 
+	// 字符设备驱动注册流程第一步：根据mode参数选择工作模式
+	for(i = 0; i < ARRAY_SIZE(chrdev_modes); i++)
+	{
+		if(sysfs_streq(mode, chrdev_modes[i].name))
+			chrdev_mode = &chrdev_modes[i];
+	}
+	if(!chrdev_mode)
+	{
+		printk(KERN_ERR " %s driver unknown mode \"%s\"\n", DEV_NAME, mode);
+		return -EINVAL;
+	}
+
+	if(nr_devs == 0 || nr_devs > MINORMASK)
+	{
+		printk(KERN_ERR " %s driver invalid nr_devs %u\n", DEV_NAME, nr_devs);
+		return -EINVAL;
+	}
+
 	// 字符设备驱动注册流程第二步：分配主次设备号，这里即支持静态指定，也支持动态申请
 	if(dev_major != 0) //static
 	{
 		devno = MKDEV(dev_major, 0);
-		result = register_chrdev_region(devno, 1, DEV_NAME);		// /proc/devices/chrdev
+		result = register_chrdev_region(devno, nr_devs, DEV_NAME);		// /proc/devices/chrdev
 	}
 	else	//动态申请
 	{
-		result = alloc_chrdev_region(&devno, 0, 1, DEV_NAME);
+		result = alloc_chrdev_region(&devno, 0, nr_devs, DEV_NAME);
 		dev_major = MAJOR(devno);		// 获取主设备号
 	}
 
@@ -132,42 +2213,53 @@ static int __init chrdev_init(void)
 	}
 	printk(KERN_DEBUG " %s driver use major %d\n", DEV_NAME, dev_major);
 
-	// 字符设备驱动注册流程第三步：分配cdev结构体，这里使用动态申请的方式
-	if((chrtest_cdev = cdev_alloc()) == NULL)
-	{
-		printk(KERN_ERR " %s driver can't alloc for the cdev\n", DEV_NAME);
-		unregister_chrdev_region(devno, 1);
-		return -ENOMEM;
-	}
-
-	// 字符设备驱动注册流程第四步：分配cdev结构体，绑定主次设备号、fops到cdev结构体中，并注册给Linux内核
-	chrtest_cdev->owner = THIS_MODULE;	//.owner表示是谁拥有你这个驱动程序
-	cdev_init(chrtest_cdev, &chrtest_fops);	//初始化设备
-	result  = cdev_add(chrtest_cdev, devno, 1);	//将字符设备注册进内核
-	if(result != 0)
+	// 字符设备驱动注册流程第三步：分配设备指针数组，设备本身在第四步逐个分配
+	chrdevs = kcalloc(nr_devs, sizeof(*chrdevs), GFP_KERNEL);
+	if(!chrdevs)
 	{
-		printk(KERN_INFO " %s driver can't register cdev:result=%d\n", DEV_NAME, result);
-		goto ERROR;
+		result = -ENOMEM;
+		goto undo_major;
 	}
-	printk(KERN_INFO " %s driver can register cdev:result=%d\n", DEV_NAME, result);
-
 
-	//自动创建设备类型、/dev设备节点
-#if 1
+	//自动创建设备类型，/dev设备节点在chrdev_setup中创建
 	chrdev_class = class_create(THIS_MODULE, DEV_NAME);	//创建设备类型 /sys/class/chrdev
 	if(IS_ERR(chrdev_class))
 	{
 		result = PTR_ERR(chrdev_class);
-		goto ERROR;
+		goto undo_devs;
 	}
-	device_create(chrdev_class, NULL, MKDEV(dev_major, 0), NULL, DEV_NAME); // /dev/chrdev 注册这个设备节点
-#endif
+
+	// 字符设备驱动注册流程第四步：逐个初始化并注册设备
+	for(i = 0; i < nr_devs; i++)
+	{
+		chrdevs[i] = kzalloc(sizeof(*chrdevs[i]), GFP_KERNEL);
+		if(!chrdevs[i])
+		{
+			result = -ENOMEM;
+			goto undo_setup;
+		}
+
+		result = chrdev_setup(chrdevs[i], i);
+		if(result != 0)
+			goto undo_setup;
+	}
+	printk(KERN_INFO " %s driver register %u devices in %s mode\n", DEV_NAME, nr_devs, chrdev_mode->name);
 
 	return 0;
-ERROR:
+
+undo_setup:
+	kfree(chrdevs[i]);		// 第i个设备没有setup成功，只需要释放
+	while(--i >= 0)
+	{
+		chrdev_teardown(chrdevs[i], i);
+		kfree(chrdevs[i]);
+	}
+	class_destroy(chrdev_class);
+undo_devs:
+	kfree(chrdevs);
+undo_major:
 	printk(KERN_ERR " %s driver installed failure.\n", DEV_NAME);
-	cdev_del(chrtest_cdev);
-	unregister_chrdev_region(devno, 1);
+	unregister_chrdev_region(devno, nr_devs);
 	return result;
 }
 
@@ -179,16 +2271,20 @@ ERROR:
  */
 static void __exit chrdev_exit(void)
 {
+	int		i;
+
 	printk("%s %s line %d\n", __FILE__, __FUNCTION__, __LINE__);
 
-	//注销设备类型、/dev设备节点
-#if 1
-	device_destroy(chrdev_class, MKDEV(dev_major, 0));	//注销这个设备节点
+	//注销每个设备和设备类型
+	for(i = 0; i < nr_devs; i++)
+	{
+		chrdev_teardown(chrdevs[i], i);
+		kfree(chrdevs[i]);
+	}
 	class_destroy(chrdev_class);	//删除这个设备类型
-#endif
 
-	cdev_del(chrtest_cdev);	//注销字符设备
-	unregister_chrdev_region(MKDEV(dev_major, 0), 1);	//释放设备号
+	kfree(chrdevs);
+	unregister_chrdev_region(MKDEV(dev_major, 0), nr_devs);	//释放设备号
 
 	printk(KERN_ERR " %s driver version 1.0.0 removed!\n", DEV_NAME);
 	return;
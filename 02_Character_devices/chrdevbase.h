@@ -0,0 +1,83 @@
+/********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  chrdevbase.h
+ *    Description:  chrdev驱动与应用程序共用的ioctl命令和mmap环形缓冲区布局
+ *
+ *        Version:  1.0.0(2023年04月16日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年04月16日 20时18分43秒"
+ *
+ ********************************************************************************/
+
+#ifndef _CHRDEVBASE_H_
+#define _CHRDEVBASE_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define CHRDEV_MAGIC			0x61	//魔术字
+
+/*
+ * 环形缓冲区的控制页，mmap偏移0处映射一页，数据区从偏移一页处开始，可一次映射也可分开映射：
+ *   head由生产者推进，tail由消费者推进，均为自由增长的下标，用 & (size-1) 取位置；
+ *   生产者先写数据再以release语义更新head，消费者以acquire语义读head后再读数据，tail同理；
+ *   c_wait/p_wait是"我要睡眠了"的标志，对端更新下标后看到标志置位才需要调用CHRDEV_IOC_KICK。
+ * head和tail放在不同的cache line上，避免生产者和消费者互相抢占同一行。
+ */
+#define CHRDEV_CACHELINE		64
+
+struct chrdev_ring_ctrl {
+	__u32	head __attribute__((aligned(CHRDEV_CACHELINE)));	// 生产者下标
+	__u32	p_wait;		// 生产者等待空间
+	__u32	tail __attribute__((aligned(CHRDEV_CACHELINE)));	// 消费者下标
+	__u32	c_wait;		// 消费者等待数据
+	__u32	size __attribute__((aligned(CHRDEV_CACHELINE)));	// 数据区大小，2的幂且页对齐
+};
+
+/* 更新下标后唤醒在read/write/poll中睡眠的对端 */
+#define CHRDEV_IOC_KICK			_IO (CHRDEV_MAGIC, 0x01)
+
+/*
+ * snapshot模式：获取本fd正在读的版本号（从偏移0读时固定为当时最新的版本），还没读过为0。
+ * 读完后查询得到的就是刚读到的数据的版本；是否有更新的版本用poll的EPOLLIN判断。
+ */
+#define CHRDEV_IOC_SNAP_VERSION	_IOR(CHRDEV_MAGIC, 0x02, __u64)
+
+/*
+ * dgram模式：每次write是一条消息，CHRDEV_IOC_RECVMMSG一次取出最多vlen条，类似recvmmsg。
+ * 至少等到一条消息（除非设置了DONTWAIT或O_NONBLOCK），之后有多少取多少，返回取到的条数。
+ */
+#define CHRDEV_MMSG_MAX			1024
+
+#define CHRDEV_MSG_TRUNC		0x1		// 缓冲区太小，消息被截断，剩余部分被丢弃
+#define CHRDEV_MMSG_DONTWAIT	0x1		// 没有消息时不等待
+
+struct chrdev_msg {
+	__u64	buf;		// 用户缓冲区地址
+	__u32	len;		// 输入为缓冲区大小，输出为消息实际长度
+	__u32	flags;		// 输出CHRDEV_MSG_TRUNC
+};
+
+struct chrdev_mmsg {
+	__u64	msgs;		// struct chrdev_msg数组的地址
+	__u32	vlen;		// 数组元素个数，最多CHRDEV_MMSG_MAX
+	__u32	flags;		// CHRDEV_MMSG_DONTWAIT
+};
+
+#define CHRDEV_IOC_RECVMMSG		_IOW (CHRDEV_MAGIC, 0x03, struct chrdev_mmsg)
+
+/*
+ * fifo/blob模式：把缓冲区导出为dma-buf，fd可交给其他驱动导入或直接mmap。
+ * fifo导出的是数据区（不含控制页），blob导出已写入的范围（按页向上取整），没有写入过时返回ENODATA。
+ * CPU读写前后用DMA_BUF_IOCTL_SYNC包起来，驱动在其中做cache同步。
+ */
+struct chrdev_dmabuf_export {
+	__u32	flags;		// 输入：O_RDONLY/O_WRONLY/O_RDWR之一，可以加O_CLOEXEC
+	__s32	fd;			// 输出：dma-buf的fd
+};
+
+#define CHRDEV_IOC_EXPORT_DMABUF	_IOWR(CHRDEV_MAGIC, 0x04, struct chrdev_dmabuf_export)
+
+#endif
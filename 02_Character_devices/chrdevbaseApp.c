@@ -17,31 +17,642 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/dma-buf.h>
+#include "chrdevbase.h"
 
 /*
  * ./chrdevbaseApp -w abc
  * ./chrdevbaseApp -r
+ * ./chrdevbaseApp -b [MB]		read/write与mmap环形缓冲区的吞吐对比，建议insmod时fifo_size=262144
+ * ./chrdevbaseApp -v [MB]		writev批量大小扫描：每条记录为头部+负载两段
+ * ./chrdevbaseApp -t [threads]	多线程写者扩展性测试，对比mode=fifo和mode=shard
+ * ./chrdevbaseApp -m [batch]		mode=dgram下逐条read与CHRDEV_IOC_RECVMMSG批量接收的对比
+ * ./chrdevbaseApp -x			把fifo/blob的缓冲区导出为dma-buf，mmap后打印开头的数据
  * */
 
+#define DEV_PATH			"/dev/chrdev0"	// 默认设备，可用环境变量CHRDEV指定其他实例
+#define BENCH_DEF_MB		64
+
+static const size_t bench_sizes[] = {64, 256, 1024, 4096, 16384, 65536};
+
+/* writev扫描：每条记录由16字节头部和112字节负载组成 */
+#define VEC_HDR_SIZE		16
+#define VEC_PAYLOAD_SIZE	112
+#define VEC_REC_SIZE		(VEC_HDR_SIZE + VEC_PAYLOAD_SIZE)
+#define VEC_MAX_BATCH		64
+
+static const int vec_batches[] = {1, 2, 4, 8, 16, 32, 64};
+
+/* 多线程写者测试：每个写者写256字节的记录，总量固定 */
+#define MT_REC_SIZE			256
+#define MT_MAX_THREADS		64
+
+/* dgram测试：写者写入固定条数的小消息 */
+#define MSG_SIZE			32
+#define MSG_COUNT			(1 << 20)
+
+/* 用户空间看到的环形缓冲区 */
+struct ring {
+	int						fd;
+	struct chrdev_ring_ctrl	*ctrl;
+	unsigned char			*data;
+	uint32_t				size;
+	size_t					pagesz;
+	unsigned long			syscalls;	// poll + KICK的次数
+};
+
+/* 一次测试的参数，生产者线程使用 */
+struct bench_arg {
+	int				fd;
+	struct ring		*ring;
+	size_t			rec_size;
+	size_t			total;
+	int				batch;		// writev每次提交的记录数，0表示头部和负载各write一次
+	unsigned long	syscalls;	// 生产者发起的write/writev次数
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ring_map(int fd, struct ring *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->pagesz = sysconf(_SC_PAGESIZE);
+
+	/* 先映射控制页拿到数据区大小，再映射数据区 */
+	r->ctrl = mmap(NULL, r->pagesz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(r->ctrl == MAP_FAILED)
+		return -1;
+
+	r->size = r->ctrl->size;
+	r->data = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, r->pagesz);
+	if(r->data == MAP_FAILED)
+	{
+		munmap(r->ctrl, r->pagesz);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void ring_unmap(struct ring *r)
+{
+	munmap(r->data, r->size);
+	munmap(r->ctrl, r->pagesz);
+}
+
+/* 置等待标志后睡眠，内核poll会复查一次，生产者/消费者看到标志后才KICK */
+static void ring_wait(struct ring *r, uint32_t *flag, short events)
+{
+	struct pollfd pfd = { .fd = r->fd, .events = events };
+
+	__atomic_store_n(flag, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	poll(&pfd, 1, -1);
+	r->syscalls++;
+}
+
+static void ring_kick(struct ring *r, uint32_t *flag)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(flag, __ATOMIC_RELAXED))
+	{
+		ioctl(r->fd, CHRDEV_IOC_KICK);
+		r->syscalls++;
+	}
+}
+
+static void ring_produce(struct ring *r, const unsigned char *rec, size_t len)
+{
+	uint32_t	head, tail, n, off, first;
+
+	while(len)
+	{
+		head = r->ctrl->head;	// head只有自己写
+		tail = __atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE);
+		if(head - tail == r->size)
+		{
+			ring_wait(r, &r->ctrl->p_wait, POLLOUT);
+			continue;
+		}
+
+		n = r->size - (head - tail);
+		n = n < len ? n : len;
+		off = head & (r->size - 1);
+		first = n < r->size - off ? n : r->size - off;
+		memcpy(r->data + off, rec, first);
+		memcpy(r->data, rec + first, n - first);
+
+		__atomic_store_n(&r->ctrl->head, head + n, __ATOMIC_RELEASE);
+		ring_kick(r, &r->ctrl->c_wait);
+
+		rec += n;
+		len -= n;
+	}
+}
+
+static uint64_t sum_bytes(const unsigned char *p, size_t len)
+{
+	uint64_t	sum = 0, w;
+	size_t		i;
+
+	for(i = 0; i + sizeof(w) <= len; i += sizeof(w))
+	{
+		memcpy(&w, p + i, sizeof(w));
+		sum += w;
+	}
+	for(; i < len; i++)
+		sum += p[i];
+
+	return sum;
+}
+
+/* 消费者直接在映射的数据区上处理记录，这里用求和代替实际处理 */
+static uint64_t ring_consume(struct ring *r, size_t len)
+{
+	uint32_t	head, tail, n, off, first;
+	uint64_t	sum = 0;
+
+	while(len)
+	{
+		tail = r->ctrl->tail;	// tail只有自己写
+		head = __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE);
+		if(head == tail)
+		{
+			ring_wait(r, &r->ctrl->c_wait, POLLIN);
+			continue;
+		}
+
+		n = head - tail;
+		n = n < len ? n : len;
+		off = tail & (r->size - 1);
+		first = n < r->size - off ? n : r->size - off;
+		sum += sum_bytes(r->data + off, first);
+		sum += sum_bytes(r->data, n - first);
+
+		__atomic_store_n(&r->ctrl->tail, tail + n, __ATOMIC_RELEASE);
+		ring_kick(r, &r->ctrl->p_wait);
+
+		len -= n;
+	}
+
+	return sum;
+}
+
+static void *bench_rw_producer(void *data)
+{
+	struct bench_arg	*arg = data;
+	unsigned char		*rec = malloc(arg->rec_size);
+	size_t				done, off;
+	ssize_t				rv;
+
+	memset(rec, 0x5a, arg->rec_size);
+	for(done = 0; done < arg->total; done += arg->rec_size)
+	{
+		for(off = 0; off < arg->rec_size; off += rv)
+		{
+			rv = write(arg->fd, rec + off, arg->rec_size - off);
+			if(rv <= 0)
+				goto out;
+		}
+	}
+out:
+	free(rec);
+	return NULL;
+}
+
+static void *bench_ring_producer(void *data)
+{
+	struct bench_arg	*arg = data;
+	unsigned char		*rec = malloc(arg->rec_size);
+	size_t				done;
+
+	memset(rec, 0x5a, arg->rec_size);
+	for(done = 0; done < arg->total; done += arg->rec_size)
+		ring_produce(arg->ring, rec, arg->rec_size);
+
+	free(rec);
+	return NULL;
+}
+
+/* read/write方式：生产者线程write，当前线程read，每次都要拷贝和系统调用 */
+static double bench_rw(int fd, size_t rec_size, size_t total)
+{
+	struct bench_arg	arg = { .fd = fd, .rec_size = rec_size, .total = total };
+	unsigned char		*buf = malloc(rec_size);
+	pthread_t			tid;
+	size_t				done = 0;
+	ssize_t				rv;
+	double				start;
+
+	start = now_sec();
+	pthread_create(&tid, NULL, bench_rw_producer, &arg);
+	while(done < total)
+	{
+		rv = read(fd, buf, rec_size);
+		if(rv <= 0)
+			break;
+		done += rv;
+	}
+	pthread_join(tid, NULL);
+
+	free(buf);
+	return total / (now_sec() - start) / (1 << 20);
+}
+
+/* mmap方式：生产者和消费者都直接访问映射的环形缓冲区，只在要睡眠/唤醒时进入内核 */
+static double bench_ring(struct ring *r, size_t rec_size, size_t total)
+{
+	struct bench_arg	arg = { .ring = r, .rec_size = rec_size, .total = total };
+	pthread_t			tid;
+	double				start;
+	volatile uint64_t	sum;
+
+	start = now_sec();
+	pthread_create(&tid, NULL, bench_ring_producer, &arg);
+	sum = ring_consume(r, total);
+	pthread_join(tid, NULL);
+	(void)sum;
+
+	return total / (now_sec() - start) / (1 << 20);
+}
+
+static int bench(int fd, size_t total_mb)
+{
+	struct ring		r;
+	size_t			i, total;
+	double			rw_mbs, ring_mbs;
+
+	if(ring_map(fd, &r) < 0)
+	{
+		printf("mmap device failure\n");
+		return -1;
+	}
+
+	printf("ring size %u bytes, %zu MB per run\n", r.size, total_mb);
+	printf("%8s %14s %14s %8s %12s\n", "record", "rw MB/s", "mmap MB/s", "speedup", "mmap sysc");
+
+	for(i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+	{
+		/* 总量取记录大小的整数倍，保证两端读写的字节数一致 */
+		total = (total_mb << 20) / bench_sizes[i] * bench_sizes[i];
+
+		rw_mbs = bench_rw(fd, bench_sizes[i], total);
+
+		r.syscalls = 0;
+		ring_mbs = bench_ring(&r, bench_sizes[i], total);
+
+		printf("%8zu %14.1f %14.1f %7.2fx %12lu\n", bench_sizes[i], rw_mbs, ring_mbs,
+				ring_mbs / rw_mbs, r.syscalls);
+	}
+
+	ring_unmap(&r);
+	return 0;
+}
+
+/* 写完整个iovec数组，FIFO空间不足时writev可能只写入一部分，跳过已写的部分继续 */
+static int writev_all(int fd, struct iovec *iov, int cnt, unsigned long *syscalls)
+{
+	ssize_t		rv;
+
+	while(cnt > 0)
+	{
+		rv = writev(fd, iov, cnt);
+		(*syscalls)++;
+		if(rv <= 0)
+			return -1;
+
+		while(cnt > 0 && (size_t)rv >= iov->iov_len)
+		{
+			rv -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + rv;
+			iov->iov_len -= rv;
+		}
+	}
+
+	return 0;
+}
+
+static void *bench_vec_producer(void *data)
+{
+	struct bench_arg	*arg = data;
+	unsigned char		hdr[VEC_MAX_BATCH][VEC_HDR_SIZE];
+	unsigned char		payload[VEC_MAX_BATCH][VEC_PAYLOAD_SIZE];
+	struct iovec		iov[VEC_MAX_BATCH * 2];
+	int					batch = arg->batch ? arg->batch : 1;
+	int					i;
+	size_t				done;
+
+	memset(hdr, 0xa5, sizeof(hdr));
+	memset(payload, 0x5a, sizeof(payload));
+
+	for(done = 0; done < arg->total; done += batch * VEC_REC_SIZE)
+	{
+		/* 每条记录的头部和负载在不同的缓冲区里，正是分散/聚集I/O的场景 */
+		for(i = 0; i < batch; i++)
+		{
+			iov[2 * i].iov_base = hdr[i];
+			iov[2 * i].iov_len = VEC_HDR_SIZE;
+			iov[2 * i + 1].iov_base = payload[i];
+			iov[2 * i + 1].iov_len = VEC_PAYLOAD_SIZE;
+		}
+
+		if(arg->batch == 0)
+		{
+			/* 对照组：头部和负载各一次write */
+			if(writev_all(arg->fd, &iov[0], 1, &arg->syscalls) < 0 ||
+					writev_all(arg->fd, &iov[1], 1, &arg->syscalls) < 0)
+				break;
+		}
+		else if(writev_all(arg->fd, iov, 2 * batch, &arg->syscalls) < 0)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int bench_vec(int fd, size_t total_mb)
+{
+	struct bench_arg	arg;
+	unsigned char		*buf = malloc(1 << 16);
+	pthread_t			tid;
+	size_t				i, done, total;
+	ssize_t				rv;
+	double				start, sec;
+
+	printf("%8s %8s %12s %12s %12s %12s\n", "batch", "iovecs", "syscalls", "rec/call", "MB/s", "Krec/s");
+
+	for(i = 0; i <= sizeof(vec_batches) / sizeof(vec_batches[0]); i++)
+	{
+		memset(&arg, 0, sizeof(arg));
+		arg.fd = fd;
+		arg.batch = i ? vec_batches[i - 1] : 0;
+		total = (total_mb << 20) / (VEC_REC_SIZE * VEC_MAX_BATCH) * (VEC_REC_SIZE * VEC_MAX_BATCH);
+		arg.total = total;
+
+		start = now_sec();
+		pthread_create(&tid, NULL, bench_vec_producer, &arg);
+		for(done = 0; done < total; done += rv)
+		{
+			rv = read(fd, buf, 1 << 16);
+			if(rv <= 0)
+				break;
+		}
+		pthread_join(tid, NULL);
+		sec = now_sec() - start;
+
+		if(arg.batch == 0)
+			printf("%8s %8d", "write", 1);
+		else
+			printf("%8d %8d", arg.batch, 2 * arg.batch);
+		printf(" %12lu %12.2f %12.1f %12.1f\n", arg.syscalls,
+				(double)(total / VEC_REC_SIZE) / arg.syscalls,
+				total / sec / (1 << 20), total / VEC_REC_SIZE / sec / 1000);
+	}
+
+	free(buf);
+	return 0;
+}
+
+static void *bench_mt_writer(void *data)
+{
+	struct bench_arg	*arg = data;
+	unsigned char		rec[MT_REC_SIZE];
+	size_t				done, off;
+	ssize_t				rv;
+
+	memset(rec, 0x5a, sizeof(rec));
+	for(done = 0; done < arg->total; done += MT_REC_SIZE)
+	{
+		for(off = 0; off < MT_REC_SIZE; off += rv)
+		{
+			rv = write(arg->fd, rec + off, MT_REC_SIZE - off);
+			if(rv <= 0)
+				return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/* 1,2,4...max_threads个写者并发写，当前线程读出全部数据，看吞吐随线程数的变化 */
+static int bench_mt(int fd, int max_threads)
+{
+	struct bench_arg	arg[MT_MAX_THREADS];
+	pthread_t			tid[MT_MAX_THREADS];
+	unsigned char		*buf = malloc(1 << 16);
+	size_t				per_thread, total, done;
+	ssize_t				rv;
+	double				start, mbs, base = 0;
+	int					n, i;
+
+	if(max_threads < 1 || max_threads > MT_MAX_THREADS)
+		max_threads = MT_MAX_THREADS;
+
+	printf("%8s %12s %12s %10s\n", "threads", "MB/s", "Krec/s", "scaling");
+
+	for(n = 1; n <= max_threads; n *= 2)
+	{
+		per_thread = ((size_t)BENCH_DEF_MB << 20) / n / MT_REC_SIZE * MT_REC_SIZE;
+		total = per_thread * n;
+
+		start = now_sec();
+		for(i = 0; i < n; i++)
+		{
+			memset(&arg[i], 0, sizeof(arg[i]));
+			arg[i].fd = fd;
+			arg[i].total = per_thread;
+			pthread_create(&tid[i], NULL, bench_mt_writer, &arg[i]);
+		}
+
+		for(done = 0; done < total; done += rv)
+		{
+			rv = read(fd, buf, 1 << 16);
+			if(rv <= 0)
+				break;
+		}
+
+		for(i = 0; i < n; i++)
+			pthread_join(tid[i], NULL);
+
+		mbs = total / (now_sec() - start) / (1 << 20);
+		if(n == 1)
+			base = mbs;
+		printf("%8d %12.1f %12.1f %9.2fx\n", n, mbs, mbs * (1 << 20) / MT_REC_SIZE / 1000, mbs / base);
+	}
+
+	free(buf);
+	return 0;
+}
+
+static void *bench_msg_writer(void *data)
+{
+	struct bench_arg	*arg = data;
+	unsigned char		msg[MSG_SIZE];
+	size_t				i;
+
+	memset(msg, 0x5a, sizeof(msg));
+	for(i = 0; i < arg->total; i++)
+	{
+		if(write(arg->fd, msg, sizeof(msg)) != sizeof(msg))
+			break;
+	}
+
+	return NULL;
+}
+
+/* batch为0时每条消息一次read，否则每次ioctl最多取batch条 */
+static int bench_msg_run(int fd, unsigned int batch)
+{
+	struct bench_arg	arg = { .fd = fd, .total = MSG_COUNT };
+	struct chrdev_msg	*msgs = calloc(batch ? batch : 1, sizeof(*msgs));
+	unsigned char		*bufs = malloc((batch ? batch : 1) * MSG_SIZE);
+	struct chrdev_mmsg	mm = { .msgs = (uintptr_t)msgs, .vlen = batch };
+	unsigned long		syscalls = 0;
+	size_t				got = 0;
+	unsigned int		i;
+	pthread_t			tid;
+	double				start, sec;
+	int					rv;
+
+	for(i = 0; i < (batch ? batch : 1); i++)
+	{
+		msgs[i].buf = (uintptr_t)(bufs + i * MSG_SIZE);
+		msgs[i].len = MSG_SIZE;
+	}
+
+	start = now_sec();
+	pthread_create(&tid, NULL, bench_msg_writer, &arg);
+	while(got < MSG_COUNT)
+	{
+		if(batch == 0)
+		{
+			rv = read(fd, bufs, MSG_SIZE) > 0 ? 1 : -1;
+		}
+		else
+		{
+			for(i = 0; i < batch; i++)
+				msgs[i].len = MSG_SIZE;
+			rv = ioctl(fd, CHRDEV_IOC_RECVMMSG, &mm);
+		}
+		syscalls++;
+		if(rv <= 0)
+			break;
+		got += rv;
+	}
+	pthread_join(tid, NULL);
+	sec = now_sec() - start;
+
+	if(batch == 0)
+		printf("%8s", "read");
+	else
+		printf("%8u", batch);
+	printf(" %12zu %12lu %12.1f %12.1f\n", got, syscalls, (double)got / syscalls, got / sec / 1000);
+
+	free(msgs);
+	free(bufs);
+	return 0;
+}
+
+static int bench_msg(int fd, unsigned int max_batch)
+{
+	unsigned int	batch;
+
+	if(max_batch == 0 || max_batch > CHRDEV_MMSG_MAX)
+		max_batch = CHRDEV_MMSG_MAX;
+
+	printf("%8s %12s %12s %12s %12s\n", "batch", "msgs", "syscalls", "msgs/call", "Kmsg/s");
+	bench_msg_run(fd, 0);
+	for(batch = 1; batch <= max_batch; batch *= 4)
+		bench_msg_run(fd, batch);
+
+	return 0;
+}
+
+/* 导出dma-buf后像导入方一样mmap，CPU访问前后用DMA_BUF_IOCTL_SYNC同步cache */
+static int dmabuf_dump(int fd)
+{
+	struct chrdev_dmabuf_export	exp = { .flags = O_RDONLY | O_CLOEXEC };	// 只读取数据，按只读导出
+	struct dma_buf_sync			sync;
+	unsigned char				*p;
+	off_t						size;
+	int							i;
+
+	if(ioctl(fd, CHRDEV_IOC_EXPORT_DMABUF, &exp) < 0)
+	{
+		perror("CHRDEV_IOC_EXPORT_DMABUF");
+		return -1;
+	}
+
+	size = lseek(exp.fd, 0, SEEK_END);	// dma-buf的fd用SEEK_END取大小
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, exp.fd, 0);
+	if(p == MAP_FAILED)
+	{
+		perror("mmap dma-buf");
+		close(exp.fd);
+		return -1;
+	}
+
+	sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+	ioctl(exp.fd, DMA_BUF_IOCTL_SYNC, &sync);
+	printf("dma-buf fd %d size %ld:", exp.fd, (long)size);
+	for(i = 0; i < 16 && i < size; i++)
+		printf(" %02x", p[i]);
+	printf("\n");
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+	ioctl(exp.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	munmap(p, size);
+	close(exp.fd);
+	return 0;
+}
+
 int main (int argc, char **argv)
 {
-	int		fd;
-	char	buf[1024];
-	int		len;
+	int			fd;
+	char		buf[1024];
+	int			len;
+	const char	*path = getenv("CHRDEV") ? getenv("CHRDEV") : DEV_PATH;
 	/* 1、判断参数 */
 	if(argc < 2)
 	{
 		printf("Usage: %s -w <string>\n", argv[0]);
 		printf("	   %s -r\n", argv[0]);
+		printf("	   %s -b [MB]\n", argv[0]);
+		printf("	   %s -v [MB]\n", argv[0]);
+		printf("	   %s -t [threads]\n", argv[0]);
+		printf("	   %s -m [batch]\n", argv[0]);
+		printf("	   %s -x\n", argv[0]);
 		return -1;
 	}
 
 	/* 2、打开文件 */
-	fd = open("/dev/chrdev", O_RDWR);
+	fd = open(path, O_RDWR);
 	if(fd == -1)
 	{
-		printf("can't open file /dev/chrdev\n");
+		printf("can't open file %s\n", path);
 		return -1;
 	}
 
@@ -54,14 +665,55 @@ int main (int argc, char **argv)
 	}
 	else if((strcmp(argv[1], "-r") == 0) && (argc == 2))
 	{
-		len = read(fd, buf, 1024);
-		buf[1023] = '\0';
+		len = read(fd, buf, sizeof(buf) - 1);	// FIFO为空时阻塞，直到有数据写入
+		if(len < 0)
+		{
+			printf("read %s failure\n", path);
+			close(fd);
+			return -1;
+		}
+		buf[len] = '\0';
 		printf("APP read : %s\n", buf);
 	}
+	else if((strcmp(argv[1], "-b") == 0) && (argc <= 3))
+	{
+		len = bench(fd, argc == 3 ? strtoul(argv[2], NULL, 0) : BENCH_DEF_MB);
+		close(fd);
+		return len;
+	}
+	else if((strcmp(argv[1], "-v") == 0) && (argc <= 3))
+	{
+		len = bench_vec(fd, argc == 3 ? strtoul(argv[2], NULL, 0) : BENCH_DEF_MB);
+		close(fd);
+		return len;
+	}
+	else if((strcmp(argv[1], "-t") == 0) && (argc <= 3))
+	{
+		len = bench_mt(fd, argc == 3 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN));
+		close(fd);
+		return len;
+	}
+	else if((strcmp(argv[1], "-m") == 0) && (argc <= 3))
+	{
+		len = bench_msg(fd, argc == 3 ? strtoul(argv[2], NULL, 0) : CHRDEV_MMSG_MAX);
+		close(fd);
+		return len;
+	}
+	else if((strcmp(argv[1], "-x") == 0) && (argc == 2))
+	{
+		len = dmabuf_dump(fd);
+		close(fd);
+		return len;
+	}
 	else
 	{
 		printf("Usage: %s -w <string>\n", argv[0]);
 		printf("	   %s -r\n", argv[0]);
+		printf("	   %s -b [MB]\n", argv[0]);
+		printf("	   %s -v [MB]\n", argv[0]);
+		printf("	   %s -t [threads]\n", argv[0]);
+		printf("	   %s -m [batch]\n", argv[0]);
+		printf("	   %s -x\n", argv[0]);
 		return -1;
 	}
 
@@ -0,0 +1,528 @@
+/*********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  chrdevbench.c
+ *    Description:  chrdev吞吐/延迟基准测试：扫描传输大小、线程数、阻塞与非阻塞，
+ *                  输出CSV或JSON，便于对比不同驱动版本
+ *
+ *        Version:  1.0.0(2023年04月17日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年04月17日 00时20分54秒"
+ *
+ ********************************************************************************/
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+
+/*
+ * ./chrdevbench [-d dev] [-s 64,4096] [-t 1,2,4] [-m block,nonblock] [-n ops] [-f csv|json]
+ *
+ * 每组配置启动threads个写者和threads个读者，各自打开设备，写者每人写ops次，
+ * 读者读完写者实际写入的总字节数后退出。每次系统调用都用CLOCK_MONOTONIC计时，
+ * 读写分别输出一行：MB/s、ops/s和p50/p99/p999延迟（纳秒）。
+ * 非阻塞模式下EAGAIN后用poll等待，只统计成功的调用，EAGAIN次数单独输出。
+ * */
+
+#define DEV_PATH			"/dev/chrdev0"	// 默认设备，可用环境变量CHRDEV或-d指定
+#define MOD_SYSFS			"/sys/module/chrdevbase"
+#define DEF_OPS				100000
+#define MAX_LIST			16
+#define MAX_THREADS			64
+#define POLL_TIMEOUT_MS		10
+
+enum { FMT_CSV, FMT_JSON };
+
+struct bench_cfg {
+	const char		*path;
+	size_t			sizes[MAX_LIST];
+	int				nsizes;
+	int				threads[MAX_LIST];
+	int				nthreads;
+	int				nonblock[2];
+	int				nmodes;
+	size_t			ops;
+	int				fmt;
+};
+
+/* 一组配置中所有线程共享的状态 */
+struct bench_run {
+	const struct bench_cfg	*cfg;
+	size_t					size;
+	int						nonblock;
+	size_t					total;		// 写者实际写入的总字节数，写者结束前为SIZE_MAX，原子访问
+	size_t					nread;		// 读者已读字节数，原子访问
+	int						stop;		// 读够了，原子访问
+	int						readers;	// 尚未退出的读者数，原子访问
+};
+
+struct bench_thread {
+	struct bench_run	*run;
+	int					write;
+	pthread_t			tid;
+	uint64_t			*lat;		// 每次成功调用的延迟
+	size_t				nlat;
+	size_t				cap;
+	size_t				bytes;
+	unsigned long		eagain;
+	int					error;
+};
+
+/* 一个角色（读或写）汇总后的结果 */
+struct bench_result {
+	size_t			ops;
+	size_t			bytes;
+	unsigned long	eagain;
+	double			sec;
+	uint64_t		p50, p99, p999;
+	int				error;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int parse_list(const char *arg, size_t *out, int max)
+{
+	char	*dup = strdup(arg), *tok, *save = NULL;
+	int		n = 0;
+
+	for(tok = strtok_r(dup, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save))
+	{
+		out[n] = strtoul(tok, NULL, 0);
+		if(out[n] == 0)
+		{
+			free(dup);
+			return -1;
+		}
+		n++;
+	}
+
+	free(dup);
+	return n;
+}
+
+static int parse_modes(const char *arg, struct bench_cfg *cfg)
+{
+	char	*dup = strdup(arg), *tok, *save = NULL;
+
+	cfg->nmodes = 0;
+	for(tok = strtok_r(dup, ",", &save); tok && cfg->nmodes < 2; tok = strtok_r(NULL, ",", &save))
+	{
+		if(strcmp(tok, "block") == 0)
+			cfg->nonblock[cfg->nmodes++] = 0;
+		else if(strcmp(tok, "nonblock") == 0)
+			cfg->nonblock[cfg->nmodes++] = 1;
+		else
+			cfg->nmodes = -1;
+		if(cfg->nmodes < 0)
+			break;
+	}
+
+	free(dup);
+	return cfg->nmodes > 0 ? 0 : -1;
+}
+
+static void lat_add(struct bench_thread *t, uint64_t ns)
+{
+	if(t->nlat == t->cap)
+	{
+		t->cap = t->cap ? t->cap * 2 : 4096;
+		t->lat = realloc(t->lat, t->cap * sizeof(*t->lat));
+	}
+	t->lat[t->nlat++] = ns;
+}
+
+/* 非阻塞模式下EAGAIN后等待可读/可写；返回0继续，-1表示出错 */
+static int wait_ready(struct bench_thread *t, int fd)
+{
+	struct pollfd	pfd = { .fd = fd, .events = t->write ? POLLOUT : POLLIN };
+
+	t->eagain++;
+	if(poll(&pfd, 1, POLL_TIMEOUT_MS) < 0 && errno != EINTR)
+	{
+		t->error = errno;
+		return -1;
+	}
+	return 0;
+}
+
+static void *bench_writer(void *data)
+{
+	struct bench_thread		*t = data;
+	struct bench_run		*run = t->run;
+	char					*buf = malloc(run->size);
+	size_t					ops = 0;
+	uint64_t				start;
+	ssize_t					rv;
+	int						fd;
+
+	memset(buf, 0x5a, run->size);
+	fd = open(run->cfg->path, O_WRONLY | (run->nonblock ? O_NONBLOCK : 0));
+	if(fd < 0)
+	{
+		t->error = errno;
+		goto out;
+	}
+
+	while(ops < run->cfg->ops)
+	{
+		start = now_ns();
+		rv = write(fd, buf, run->size);
+		if(rv < 0)
+		{
+			if(errno == EAGAIN && wait_ready(t, fd) == 0)
+				continue;
+			if(errno != EAGAIN)
+				t->error = errno;
+			break;
+		}
+		lat_add(t, now_ns() - start);
+		t->bytes += rv;
+		ops++;
+	}
+
+	close(fd);
+out:
+	free(buf);
+	return NULL;
+}
+
+static void *bench_reader(void *data)
+{
+	struct bench_thread		*t = data;
+	struct bench_run		*run = t->run;
+	char					*buf = malloc(run->size);
+	uint64_t				start;
+	ssize_t					rv;
+	int						fd;
+
+	fd = open(run->cfg->path, O_RDONLY | (run->nonblock ? O_NONBLOCK : 0));
+	if(fd < 0)
+	{
+		t->error = errno;
+		__atomic_store_n(&run->stop, 1, __ATOMIC_RELEASE);
+		goto out;
+	}
+
+	while(!__atomic_load_n(&run->stop, __ATOMIC_ACQUIRE))
+	{
+		start = now_ns();
+		rv = read(fd, buf, run->size);
+		if(rv < 0)
+		{
+			if(errno == EAGAIN && wait_ready(t, fd) == 0)
+				continue;
+			if(errno != EAGAIN)
+				t->error = errno;
+			__atomic_store_n(&run->stop, 1, __ATOMIC_RELEASE);
+			break;
+		}
+		lat_add(t, now_ns() - start);
+		t->bytes += rv;
+		if(__atomic_add_fetch(&run->nread, rv, __ATOMIC_ACQ_REL) >= __atomic_load_n(&run->total, __ATOMIC_ACQUIRE))
+			__atomic_store_n(&run->stop, 1, __ATOMIC_RELEASE);
+	}
+
+	close(fd);
+out:
+	free(buf);
+	__atomic_sub_fetch(&run->readers, 1, __ATOMIC_ACQ_REL);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *v, size_t n, double p)
+{
+	size_t	idx;
+
+	if(n == 0)
+		return 0;
+	idx = (size_t)(p * (n - 1) + 0.5);
+	return v[idx];
+}
+
+/* 合并同一角色所有线程的延迟样本并排序取分位数 */
+static void collect(struct bench_thread *t, int n, double sec, struct bench_result *res)
+{
+	uint64_t	*all;
+	size_t		off = 0;
+	int			i;
+
+	memset(res, 0, sizeof(*res));
+	for(i = 0; i < n; i++)
+	{
+		res->ops += t[i].nlat;
+		res->bytes += t[i].bytes;
+		res->eagain += t[i].eagain;
+		if(t[i].error)
+			res->error = t[i].error;
+	}
+	res->sec = sec;
+
+	all = malloc((res->ops ? res->ops : 1) * sizeof(*all));
+	for(i = 0; i < n; i++)
+	{
+		memcpy(all + off, t[i].lat, t[i].nlat * sizeof(*all));
+		off += t[i].nlat;
+		free(t[i].lat);
+	}
+	qsort(all, res->ops, sizeof(*all), cmp_u64);
+	res->p50 = percentile(all, res->ops, 0.50);
+	res->p99 = percentile(all, res->ops, 0.99);
+	res->p999 = percentile(all, res->ops, 0.999);
+	free(all);
+}
+
+/* 清空上一组配置残留的数据 */
+static void fifo_drain(const char *path)
+{
+	char	buf[4096];
+	int		fd = open(path, O_RDONLY | O_NONBLOCK);
+
+	if(fd < 0)
+		return;
+	while(read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+}
+
+static int bench_one(const struct bench_cfg *cfg, size_t size, int threads, int nonblock,
+					 struct bench_result *wres, struct bench_result *rres)
+{
+	struct bench_run	run = { .cfg = cfg, .size = size, .nonblock = nonblock };
+	struct bench_thread	wr[MAX_THREADS], rd[MAX_THREADS];
+	char				*pad = calloc(1, size);
+	uint64_t			start, wend, rend;
+	size_t				written;
+	int					i, fd;
+
+	memset(wr, 0, sizeof(wr));
+	memset(rd, 0, sizeof(rd));
+	fifo_drain(cfg->path);
+
+	run.total = SIZE_MAX;
+	run.readers = threads;
+
+	start = now_ns();
+	for(i = 0; i < threads; i++)
+	{
+		rd[i].run = &run;
+		pthread_create(&rd[i].tid, NULL, bench_reader, &rd[i]);
+		wr[i].run = &run;
+		wr[i].write = 1;
+		pthread_create(&wr[i].tid, NULL, bench_writer, &wr[i]);
+	}
+	for(i = 0; i < threads; i++)
+		pthread_join(wr[i].tid, NULL);
+	wend = now_ns();
+
+	/* 写者全部结束后才知道总量；读够了或写者出错就叫停，阻塞在read里的读者靠填充数据唤醒 */
+	for(i = 0, written = 0; i < threads; i++)
+	{
+		written += wr[i].bytes;
+		if(wr[i].error)
+			__atomic_store_n(&run.stop, 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&run.total, written, __ATOMIC_RELEASE);
+	if(__atomic_load_n(&run.nread, __ATOMIC_ACQUIRE) >= written)
+		__atomic_store_n(&run.stop, 1, __ATOMIC_RELEASE);
+	fd = open(cfg->path, O_WRONLY | O_NONBLOCK);
+	while(__atomic_load_n(&run.readers, __ATOMIC_ACQUIRE))
+	{
+		if(!__atomic_load_n(&run.stop, __ATOMIC_ACQUIRE))
+		{
+			usleep(1000);
+			continue;
+		}
+		if(fd >= 0)
+			write(fd, pad, size);
+		usleep(1000);
+	}
+	if(fd >= 0)
+		close(fd);
+	rend = now_ns();
+
+	for(i = 0; i < threads; i++)
+		pthread_join(rd[i].tid, NULL);
+
+	collect(wr, threads, (wend - start) / 1e9, wres);
+	collect(rd, threads, (rend - start) / 1e9, rres);
+	free(pad);
+
+	return (wres->error || rres->error) ? -1 : 0;
+}
+
+static void read_sysfs(const char *file, char *buf, size_t len)
+{
+	FILE	*fp = fopen(file, "r");
+
+	snprintf(buf, len, "unknown");
+	if(!fp)
+		return;
+	if(fgets(buf, len, fp))
+		buf[strcspn(buf, "\n")] = '\0';
+	fclose(fp);
+}
+
+static void print_result(const struct bench_cfg *cfg, int *first, size_t size, int threads, int nonblock,
+						 const char *role, const struct bench_result *res)
+{
+	double	mbs = res->sec > 0 ? res->bytes / res->sec / (1 << 20) : 0;
+	double	opss = res->sec > 0 ? res->ops / res->sec : 0;
+
+	if(cfg->fmt == FMT_CSV)
+	{
+		printf("%zu,%d,%s,%s,%zu,%zu,%lu,%.2f,%.0f,%llu,%llu,%llu,%s\n",
+			   size, threads, nonblock ? "nonblock" : "block", role, res->ops, res->bytes, res->eagain,
+			   mbs, opss, (unsigned long long)res->p50, (unsigned long long)res->p99,
+			   (unsigned long long)res->p999, res->error ? strerror(res->error) : "");
+		return;
+	}
+
+	printf("%s\n    {\"size\": %zu, \"threads\": %d, \"mode\": \"%s\", \"role\": \"%s\", "
+		   "\"ops\": %zu, \"bytes\": %zu, \"eagain\": %lu, \"mb_s\": %.2f, \"ops_s\": %.0f, "
+		   "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"error\": \"%s\"}",
+		   *first ? "" : ",", size, threads, nonblock ? "nonblock" : "block", role,
+		   res->ops, res->bytes, res->eagain, mbs, opss, (unsigned long long)res->p50,
+		   (unsigned long long)res->p99, (unsigned long long)res->p999,
+		   res->error ? strerror(res->error) : "");
+	*first = 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-d dev] [-s sizes] [-t threads] [-m block,nonblock] [-n ops] [-f csv|json]\n", prog);
+	printf("       sizes/threads are comma separated lists, e.g. -s 64,4096 -t 1,4\n");
+}
+
+int main (int argc, char **argv)
+{
+	struct bench_cfg	cfg = {
+		.path = getenv("CHRDEV") ? getenv("CHRDEV") : DEV_PATH,
+		.sizes = {64, 256, 1024, 4096, 16384}, .nsizes = 5,
+		.threads = {1, 2, 4}, .nthreads = 3,
+		.nonblock = {0, 1}, .nmodes = 2,
+		.ops = DEF_OPS,
+		.fmt = FMT_CSV,
+	};
+	struct bench_result	wres, rres;
+	struct utsname		uts;
+	size_t				list[MAX_LIST];
+	char				mode[64], srcver[64];
+	int					opt, n, s, t, m, first = 1, rv = 0;
+
+	while((opt = getopt(argc, argv, "d:s:t:m:n:f:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'd':
+				cfg.path = optarg;
+				break;
+			case 's':
+				cfg.nsizes = parse_list(optarg, cfg.sizes, MAX_LIST);
+				if(cfg.nsizes <= 0)
+					goto bad_arg;
+				break;
+			case 't':
+				n = parse_list(optarg, list, MAX_LIST);
+				if(n <= 0)
+					goto bad_arg;
+				for(cfg.nthreads = 0; cfg.nthreads < n; cfg.nthreads++)
+				{
+					if(list[cfg.nthreads] > MAX_THREADS)
+						goto bad_arg;
+					cfg.threads[cfg.nthreads] = list[cfg.nthreads];
+				}
+				break;
+			case 'm':
+				if(parse_modes(optarg, &cfg) < 0)
+					goto bad_arg;
+				break;
+			case 'n':
+				cfg.ops = strtoul(optarg, NULL, 0);
+				if(cfg.ops == 0)
+					goto bad_arg;
+				break;
+			case 'f':
+				if(strcmp(optarg, "csv") == 0)
+					cfg.fmt = FMT_CSV;
+				else if(strcmp(optarg, "json") == 0)
+					cfg.fmt = FMT_JSON;
+				else
+					goto bad_arg;
+				break;
+			default:
+				goto bad_arg;
+		}
+	}
+
+	if(access(cfg.path, R_OK | W_OK) != 0)
+	{
+		printf("can't open file %s\n", cfg.path);
+		return -1;
+	}
+
+	/* 记录驱动版本和工作模式，方便对比不同版本的结果 */
+	read_sysfs(MOD_SYSFS "/parameters/mode", mode, sizeof(mode));
+	read_sysfs(MOD_SYSFS "/srcversion", srcver, sizeof(srcver));
+	uname(&uts);
+
+	if(cfg.fmt == FMT_CSV)
+	{
+		printf("# device=%s mode=%s srcversion=%s kernel=%s ops=%zu\n", cfg.path, mode, srcver, uts.release, cfg.ops);
+		printf("size,threads,mode,role,ops,bytes,eagain,mb_s,ops_s,p50_ns,p99_ns,p999_ns,error\n");
+	}
+	else
+	{
+		printf("{\n  \"device\": \"%s\", \"mode\": \"%s\", \"srcversion\": \"%s\", \"kernel\": \"%s\", \"ops\": %zu,\n"
+			   "  \"results\": [", cfg.path, mode, srcver, uts.release, cfg.ops);
+	}
+
+	for(s = 0; s < cfg.nsizes; s++)
+	{
+		for(t = 0; t < cfg.nthreads; t++)
+		{
+			for(m = 0; m < cfg.nmodes; m++)
+			{
+				if(bench_one(&cfg, cfg.sizes[s], cfg.threads[t], cfg.nonblock[m], &wres, &rres) < 0)
+					rv = -1;
+				print_result(&cfg, &first, cfg.sizes[s], cfg.threads[t], cfg.nonblock[m], "write", &wres);
+				print_result(&cfg, &first, cfg.sizes[s], cfg.threads[t], cfg.nonblock[m], "read", &rres);
+				fflush(stdout);
+			}
+		}
+	}
+
+	if(cfg.fmt == FMT_JSON)
+		printf("\n  ]\n}\n");
+
+	return rv;
+
+bad_arg:
+	usage(argv[0]);
+	return -1;
+}
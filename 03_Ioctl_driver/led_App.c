@@ -21,13 +21,25 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <time.h>
+#include "led_gpio.h"
 
-#define LED_CNT				1
-#define DEVNAME_LEN			30
+/*
+ * ./led_App				用户态循环ioctl开关LED
+ * ./led_App -p [repeat]	上传心跳闪烁模式由驱动播放，repeat为0时一直播放，立即返回
+ * ./led_App -b duty [freq]	软件PWM调光，duty为0~255
+ * ./led_App -m value [mask]	一次ioctl整组设置LED，bit i对应第i个LED，mask默认为全部
+ * ./led_App -k				流水灯，每帧只需一次ioctl
+ * ./led_App -s				第i个LED以2^i Hz同相闪烁，由驱动的一个定时器调度
+ * ./led_App -l [count]		连续count次LED_ON/LED_OFF，打印驱动统计的ioctl到GPIO延迟直方图（需要挂载debugfs）
+ * ./led_App -t [count]		对比mmap寄存器直接翻转第0个LED和ioctl的耗时（需要allow_mmap=1和root）
+ * */
 
-#define PLATDRV_MAGIC		0x60
-#define LED_OFF				_IO (PLATDRV_MAGIC, 0x18)
-#define LED_ON				_IO (PLATDRV_MAGIC, 0x19)
+#define DEVNAME_LEN			30
+#define LAT_DEF_COUNT		100000
+#define LAT_DEBUGFS			"/sys/kernel/debug/my_led/"
 
 static inline int msleep(unsigned long ms)
 {
@@ -38,35 +50,284 @@ static inline int msleep(unsigned long ms)
 }
 
 
+/* 心跳：亮100ms、灭100ms、亮100ms、灭700ms */
+static int led_heartbeat(int fd, unsigned int repeat)
+{
+	struct led_pattern	pat;
+
+	memset(&pat, 0, sizeof(pat));
+	pat.nsteps = 4;
+	pat.repeat = repeat;
+	pat.steps[0] = (struct led_step){ .level = 1, .duration_us = 100000 };
+	pat.steps[1] = (struct led_step){ .level = 0, .duration_us = 100000 };
+	pat.steps[2] = (struct led_step){ .level = 1, .duration_us = 100000 };
+	pat.steps[3] = (struct led_step){ .level = 0, .duration_us = 700000 };
+
+	if(ioctl(fd, LED_SET_PATTERN, &pat) < 0)
+	{
+		perror("LED_SET_PATTERN");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* 清空驱动的延迟统计后连续开关LED，最后打印用户态平均耗时和驱动的直方图 */
+static int led_latency(int fd, unsigned long count)
+{
+	struct timespec	t0, t1;
+	unsigned long	i;
+	char			line[128];
+	FILE			*fp;
+	double			ns;
+
+	if(count == 0)
+		count = LAT_DEF_COUNT;
+
+	fp = fopen(LAT_DEBUGFS "latency_reset", "w");
+	if(!fp)
+	{
+		perror("open " LAT_DEBUGFS "latency_reset");
+		return -1;
+	}
+	fputs("1", fp);
+	fclose(fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < count; i++)
+	{
+		if(ioctl(fd, (i & 1) ? LED_OFF : LED_ON) < 0)
+		{
+			perror("ioctl");
+			return -1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	printf("%lu ioctls, user round trip avg %.0f ns\n", count, ns / count);
+
+	fp = fopen(LAT_DEBUGFS "latency", "r");
+	if(!fp)
+	{
+		perror("open " LAT_DEBUGFS "latency");
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp))
+		fputs(line, stdout);
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * 第0个LED分别用ioctl和mmap的数据寄存器各翻转count次，打印平均每次的耗时。
+ * 驱动不允许mmap时改用一页匿名内存，只测量用户态读-改-写本身的开销。
+ */
+static double toggle_elapsed(struct timespec *t0)
+{
+	struct timespec	t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e9 + (t1.tv_nsec - t0->tv_nsec);
+}
+
+static int led_toggle_bench(int fd, unsigned long count)
+{
+	struct led_mmap_info	info = { .led = 0 };
+	struct timespec			t0;
+	volatile uint32_t		*dr;
+	uint32_t				bit;
+	unsigned long			i;
+	void					*map;
+	const char				*what = "mmap";
+	double					ns;
+
+	if(count == 0)
+		count = LAT_DEF_COUNT;
+
+	if(ioctl(fd, LED_GET_MMAP_INFO, &info) < 0)
+	{
+		perror("LED_GET_MMAP_INFO");
+		return -1;
+	}
+
+	map = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		perror("mmap /dev/my_led, fall back to anonymous page");
+		map = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(map == MAP_FAILED)
+		{
+			perror("mmap");
+			return -1;
+		}
+		what = "anon";
+	}
+	else if(info.flags & LED_MMAP_FAKE)
+	{
+		what = "fake";
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < count; i++)
+	{
+		if(ioctl(fd, (i & 1) ? LED_OFF : LED_ON) < 0)
+		{
+			perror("ioctl");
+			munmap(map, getpagesize());
+			return -1;
+		}
+	}
+	ns = toggle_elapsed(&t0);
+	printf("ioctl  %lu toggles, avg %.1f ns\n", count, ns / count);
+
+	dr = (volatile uint32_t *)((char *)map + info.reg_off);
+	bit = 1u << info.bit;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < count; i++)
+		*dr ^= bit;
+	ns = toggle_elapsed(&t0);
+	printf("%-6s %lu toggles, avg %.1f ns\n", what, count, ns / count);
+
+	munmap(map, getpagesize());
+	ioctl(fd, LED_OFF);		// 直接写寄存器后驱动缓存的状态可能不对，回到已知状态
+
+	return 0;
+}
+
+/* 第i个LED以2^i Hz闪烁，各占空比50%，SYNC保证相位锁定 */
+static int led_sync_blink(int fd)
+{
+	struct led_pattern_ex	pex;
+	unsigned int			cnt, i;
+
+	if(ioctl(fd, LED_GET_COUNT, &cnt) < 0)
+	{
+		perror("LED_GET_COUNT");
+		return -1;
+	}
+
+	for(i = 0; i < cnt && i < 8; i++)
+	{
+		memset(&pex, 0, sizeof(pex));
+		pex.led = i;
+		pex.flags = LED_PATTERN_SYNC;
+		pex.pattern.nsteps = 2;
+		pex.pattern.steps[0] = (struct led_step){ .level = 1, .duration_us = 500000 >> i };
+		pex.pattern.steps[1] = (struct led_step){ .level = 0, .duration_us = 500000 >> i };
+		if(ioctl(fd, LED_SET_LED_PATTERN, &pex) < 0)
+		{
+			perror("LED_SET_LED_PATTERN");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 int main (int argc, char **argv)
 {
-	int				fd[LED_CNT];
+	int				fd;
+	int				rv = 0;
+	unsigned int	cnt, i;
 	char			dev_name[DEVNAME_LEN];
 
 	memset(dev_name, 0, sizeof(dev_name));
 	snprintf(dev_name, sizeof(dev_name), "/dev/my_led");
-	fd[LED_CNT] = open(dev_name, O_RDWR, 0755);
-	if(fd[LED_CNT] < 0)
+	fd = open(dev_name, O_RDWR, 0755);
+	if(fd < 0)
 	{
 		printf("file %s open failure!\n", dev_name);
-		goto err;
+		return -1;
 	}
 
-	printf("open fd: %s [%d] successfully.\n", dev_name, fd[LED_CNT]);
+	printf("open fd: %s [%d] successfully.\n", dev_name, fd);
+
+	if(argc >= 2 && strcmp(argv[1], "-p") == 0)
+	{
+		rv = led_heartbeat(fd, argc == 3 ? strtoul(argv[2], NULL, 0) : 0);
+		close(fd);
+		return rv;
+	}
+
+	if(argc >= 3 && strcmp(argv[1], "-b") == 0)
+	{
+		struct led_pwm	pwm = { .led = 0 };
+
+		pwm.duty = strtoul(argv[2], NULL, 0);
+		pwm.freq_hz = argc == 4 ? strtoul(argv[3], NULL, 0) : 0;
+		rv = ioctl(fd, LED_SET_PWM, &pwm);
+		if(rv < 0)
+			perror("LED_SET_PWM");
+		close(fd);
+		return rv;
+	}
+
+	if(argc >= 3 && strcmp(argv[1], "-m") == 0)
+	{
+		struct led_bank	bank;
+
+		bank.value = strtoul(argv[2], NULL, 0);
+		bank.mask = argc == 4 ? strtoul(argv[3], NULL, 0) : ~0u;
+		if(argc != 4 && ioctl(fd, LED_GET_COUNT, &cnt) == 0)
+			bank.mask = (cnt >= 32) ? ~0u : (1u << cnt) - 1;
+		rv = ioctl(fd, LED_SET_BANK, &bank);
+		if(rv < 0)
+			perror("LED_SET_BANK");
+		close(fd);
+		return rv;
+	}
+
+	if(argc == 2 && strcmp(argv[1], "-s") == 0)
+	{
+		rv = led_sync_blink(fd);
+		close(fd);
+		return rv;
+	}
+
+	if(argc >= 2 && strcmp(argv[1], "-l") == 0)
+	{
+		rv = led_latency(fd, argc == 3 ? strtoul(argv[2], NULL, 0) : LAT_DEF_COUNT);
+		close(fd);
+		return rv;
+	}
+
+	if(argc >= 2 && strcmp(argv[1], "-t") == 0)
+	{
+		rv = led_toggle_bench(fd, argc == 3 ? strtoul(argv[2], NULL, 0) : LAT_DEF_COUNT);
+		close(fd);
+		return rv;
+	}
+
+	if(argc == 2 && strcmp(argv[1], "-k") == 0)
+	{
+		struct led_bank	bank;
+
+		if(ioctl(fd, LED_GET_COUNT, &cnt) < 0 || cnt == 0)
+		{
+			perror("LED_GET_COUNT");
+			close(fd);
+			return -1;
+		}
+		bank.mask = (cnt >= 32) ? ~0u : (1u << cnt) - 1;
+		for(i = 0; ; i = (i + 1) % cnt)
+		{
+			bank.value = 1u << i;
+			ioctl(fd, LED_SET_BANK, &bank);
+			msleep(100);
+		}
+	}
 
 	while(1)
 	{
-		ioctl(fd[LED_CNT], LED_ON);
+		ioctl(fd, LED_ON);
 		msleep(300);
-		ioctl(fd[LED_CNT], LED_OFF);
+		ioctl(fd, LED_OFF);
 		msleep(300);
 	}
 
-	close(fd[LED_CNT]);
+	close(fd);
 	return 0;
-
-err:
-	close(fd[LED_CNT]);
-	return -1;
 } 
 
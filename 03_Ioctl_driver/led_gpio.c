@@ -27,6 +27,26 @@
 #include <linux/gpio/consumer.h>
 #include <linux/of_gpio.h>
 #include <linux/platform_device.h>
+#include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/leds.h>
+#include <linux/property.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/gpio/driver.h>
+#include <linux/capability.h>
+#include "led_gpio.h"
 
 #define DEV_NAME		"my_led"	//最后在/dev路径下的设备名称，应用层open的字符串名
 
@@ -36,19 +56,81 @@
 #define DEV_MAJOR 0
 #endif
 
-#define PLATDRV_MAGIC			0x60	//魔术字
-#define LED_OFF					_IO (PLATDRV_MAGIC, 0x18)
-#define LED_ON					_IO (PLATDRV_MAGIC, 0x19)
-
 static int dev_major = DEV_MAJOR;		/* 主设备号 */
 
+static bool allow_mmap;
+module_param(allow_mmap, bool, 0644);
+MODULE_PARM_DESC(allow_mmap, "Allow CAP_SYS_RAWIO users to mmap the LED GPIO data register page");
+
+#define LED_MAX					8		/* led-gpios中最多的LED数 */
+#define LED_PWM_SLACK_NS		5000	/* 相距不超过5us的边沿合并到同一次定时器中断 */
+#define LED_SCHED_SLACK_NS		50000	/* 闪烁模式中相距不超过50us的变化一起输出，肉眼无法分辨 */
+
+#define LED_GPIO_DR				0x00	/* i.MX GPIO数据寄存器偏移，没有置位/清零寄存器 */
+
+#define LED_LAT_BUCKETS			32		/* 第i个桶统计[2^i, 2^(i+1))纳秒，第0个桶含0 */
+
+/* ioctl进入驱动到GPIO写完的延迟统计 */
+struct led_lat_stat {
+	u64					count;
+	u64					sum_ns;
+	u64					min_ns;
+	u64					max_ns;
+	u64					hist[LED_LAT_BUCKETS];
+};
+
+/* 一个LED的闪烁模式播放状态 */
+struct led_sched {
+	struct led_pattern	pat;
+	unsigned int		step;			/* 下一步的下标 */
+	unsigned int		loops;			/* 已经播完的遍数 */
+	ktime_t				next;			/* 下一步开始的绝对时间 */
+};
+
+/* 软件PWM：所有LED共用一个定时器和周期，周期开始时一起点亮，各自在占空比处熄灭 */
+struct led_pwm_stat {
+	u64					count;			/* 统计的周期数 */
+	u64					sum_ns;			/* 实际周期与设定周期之差的绝对值之和 */
+	u64					max_ns;			/* 最大抖动 */
+};
+
 struct led_device {
 	dev_t				devid;			/* 设备号 */
 	struct cdev			cdev;			/* cdev结构体，字符设备结构体 */
 	struct class		*class;			/* 定义一个class用于创造类 */
 	struct device		*device;		/* 设备 */
 	struct device_node	*node;			/* LED设备节点 */
-	struct gpio_desc	*led_gpio;		/* led灯GPIO描述符 */
+	struct gpio_descs	*leds;			/* led-gpios数组，可以一次写整组 */
+	bool				cansleep;		/* GPIO控制器会睡眠时不能在定时器中操作 */
+	spinlock_t			gpio_lock;		/* 保护state，ioctl和定时器都通过它写GPIO */
+	unsigned long		state;			/* 各LED当前的亮灭，bit为1表示亮 */
+	struct mutex		lock;			/* 串行化ioctl，修改模式前先停掉定时器 */
+	struct hrtimer		timer;			/* 所有LED的闪烁模式共用的定时器 */
+	unsigned long		sched_mask;		/* 正在播放闪烁模式的LED，定时器停止时才能修改 */
+	ktime_t				epoch;			/* 时间线起点，LED_PATTERN_SYNC按它对齐相位 */
+	struct led_sched	sched[LED_MAX];
+	unsigned int		nleds;			/* LED个数 */
+	struct hrtimer		pwm_timer;		/* 所有LED共用的PWM定时器 */
+	u32					pwm_period_ns;	/* PWM周期 */
+	u32					pwm_pos_ns;		/* 当前这次到期在周期内的位置，0为周期开始 */
+	spinlock_t			pwm_lock;		/* 保护以下定时器用到的PWM状态 */
+	bool				pwm_running;	/* 定时器在跑，没有LED需要PWM时在周期开始处自己停下 */
+	u32					pwm_mask;		/* 处于PWM状态的LED，占空比为0或255时不需要定时器 */
+	u8					pwm_duty[LED_MAX];
+	u32					pwm_off_ns[LED_MAX];	/* 各LED在周期内熄灭的位置 */
+	bool				pwm_dirty;		/* pwm_new_*还没被定时器取用 */
+	u32					pwm_new_mask;	/* 按pwm_duty算出的新值，下一个周期开始时生效 */
+	u32					pwm_new_off_ns[LED_MAX];
+	ktime_t				pwm_last;		/* 上一个周期实际开始的时间 */
+	spinlock_t			stat_lock;		/* 保护pwm_stat，定时器在中断上下文中更新 */
+	struct led_pwm_stat	pwm_stat;
+	struct dentry		*debugfs;
+	struct led_lat_stat	lat;			/* 由dev->lock保护 */
+	struct led_classdev	led_cdevs[LED_MAX];	/* /sys/class/leds/my_led:N，内核触发器直接驱动GPIO */
+	char				led_names[LED_MAX][16];
+	struct led_mmap_info mmap_info[LED_MAX];	/* 各LED所在GPIO组的寄存器页信息 */
+	phys_addr_t			mmap_phys[LED_MAX];	/* 寄存器页的物理地址，0表示用fake_page代替 */
+	struct page			*fake_page;		/* 没有可映射的寄存器时（如x86测试环境）映射的普通内存页 */
 };
 
 struct led_device led_dev;	// LED设备
@@ -73,57 +155,855 @@ static void print_led_help(void)
 	printk("Follow is the ioctl() command for LED driver:\n");
 	printk("Turn LED on command			: %u\n", LED_ON);
 	printk("TUrn LED off command		: %u\n", LED_OFF);
+	printk("Play LED pattern command	: %u\n", LED_SET_PATTERN);
+	printk("Play pattern on one LED		: %u\n", LED_SET_LED_PATTERN);
+	printk("Set LED PWM command			: %u\n", LED_SET_PWM);
+	printk("Set LED bank command		: %u\n", LED_SET_BANK);
+	printk("Get LED count command		: %u\n", LED_GET_COUNT);
+	printk("Get LED mmap info command	: %u\n", LED_GET_MMAP_INFO);
+}
+
+/*
+ * 把mask中的LED设为value中对应的亮灭，其余保持不变，整组LED用一次gpiod_set_array_value写出，
+ * 同一个GPIO控制器上的LED在一次寄存器写中同时变化。低电平点亮，与LED_ON/LED_OFF一致。
+ * 可在定时器中调用；会睡眠的GPIO只在持有dev->lock、没有定时器运行时调用。
+ */
+static void led_bank_write(struct led_device *dev, unsigned long mask, unsigned long value)
+{
+	unsigned long	raw, flags;
+
+	if(dev->cansleep)
+	{
+		dev->state = (dev->state & ~mask) | (value & mask);
+		raw = ~dev->state & GENMASK(dev->leds->ndescs - 1, 0);
+		gpiod_set_array_value_cansleep(dev->leds->ndescs, dev->leds->desc, dev->leds->info, &raw);
+		return;
+	}
+
+	spin_lock_irqsave(&dev->gpio_lock, flags);
+	dev->state = (dev->state & ~mask) | (value & mask);
+	raw = ~dev->state & GENMASK(dev->leds->ndescs - 1, 0);
+	gpiod_set_array_value(dev->leds->ndescs, dev->leds->desc, dev->leds->info, &raw);
+	spin_unlock_irqrestore(&dev->gpio_lock, flags);
+}
+
+static inline void led_set_idx(struct led_device *dev, unsigned int idx, bool on)
+{
+	led_bank_write(dev, BIT(idx), on ? BIT(idx) : 0);
+}
+
+/* 第0个LED，LED_ON/LED_OFF和LED_SET_PATTERN控制它 */
+static inline void led_set(struct led_device *dev, bool on)
+{
+	led_set_idx(dev, 0, on);
+}
+
+/*
+ * 闪烁调度：所有LED的闪烁模式放在同一个hrtimer的时间线上，每个LED记录下一次变化的绝对时间，
+ * 定时器只在最近的一次变化时醒来，相距不超过LED_SCHED_SLACK_NS的变化用一次整组写同时输出。
+ * 下一次变化时间都在各自计划时间上累加，不受中断延迟影响，长时间播放各LED的相位也不会漂移。
+ */
+static enum hrtimer_restart led_sched_timer(struct hrtimer *timer)
+{
+	struct led_device	*dev = container_of(timer, struct led_device, timer);
+	ktime_t				now = hrtimer_get_expires(timer);	// 按计划时间推进，而不是实际醒来的时间
+	ktime_t				next = KTIME_MAX;
+	unsigned long		active = dev->sched_mask;
+	unsigned long		mask = 0, value = 0;
+	struct led_sched	*c;
+	struct led_step		*st;
+	unsigned int		i;
+
+	for_each_set_bit(i, &active, LED_MAX)
+	{
+		c = &dev->sched[i];
+		if(ktime_after(c->next, ktime_add_ns(now, LED_SCHED_SLACK_NS)))
+		{
+			next = min(next, c->next);
+			continue;
+		}
+
+		st = &c->pat.steps[c->step];
+		mask |= BIT(i);
+		if(st->level)
+			value |= BIT(i);
+
+		c->next = ktime_add_ns(c->next, (u64)st->duration_us * NSEC_PER_USEC);
+		if(++c->step == c->pat.nsteps)
+		{
+			c->step = 0;
+			if(c->pat.repeat && ++c->loops == c->pat.repeat)
+			{
+				dev->sched_mask &= ~BIT(i);	// 播放结束，保持最后一步的电平
+				continue;
+			}
+		}
+		next = min(next, c->next);
+	}
+
+	led_bank_write(dev, mask, value);
+
+	if(!dev->sched_mask)
+		return HRTIMER_NORESTART;
+
+	hrtimer_set_expires(timer, next);
+	return HRTIMER_RESTART;
+}
+
+/* 定时器停止时调用：从所有LED中最早的变化时间开始调度 */
+static void led_sched_start(struct led_device *dev)
+{
+	unsigned long	active = dev->sched_mask;
+	ktime_t			next = KTIME_MAX;
+	unsigned int	i;
+
+	for_each_set_bit(i, &active, LED_MAX)
+		next = min(next, dev->sched[i].next);
+
+	if(active)
+		hrtimer_start(&dev->timer, next, HRTIMER_MODE_ABS);
+}
+
+/* 停止mask中LED的闪烁模式，其余LED的计划时间是绝对时间，不受影响 */
+static void led_sched_stop(struct led_device *dev, unsigned long mask)
+{
+	if(!(dev->sched_mask & mask))
+		return;
+
+	hrtimer_cancel(&dev->timer);	// 等正在执行的回调结束，之后可以安全修改调度状态
+	dev->sched_mask &= ~mask;
+	led_sched_start(dev);
+}
+
+static int led_check_pattern(struct led_device *dev, const struct led_pattern *pat)
+{
+	unsigned int	i;
+
+	if(pat->nsteps > LED_PATTERN_MAX)
+		return -EINVAL;
+
+	for(i = 0; i < pat->nsteps; i++)
+	{
+		if(pat->steps[i].duration_us < LED_STEP_MIN_US)
+			return -EINVAL;
+	}
+
+	if(pat->nsteps && dev->cansleep)
+		return -EOPNOTSUPP;	// 定时器在中断上下文中运行，不能操作会睡眠的GPIO
+
+	return 0;
+}
+
+/*
+ * LED_PATTERN_SYNC：按模式从时间线起点开始一直播放的相位加入，频率成倍数关系的LED始终同相。
+ * 当前一步马上输出，剩余时间过后进入下一步；repeat从加入时算起。
+ */
+static void led_sched_join(struct led_device *dev, unsigned int idx, ktime_t now)
+{
+	struct led_sched	*c = &dev->sched[idx];
+	u64					total = 0, off;
+	unsigned int		i;
+
+	for(i = 0; i < c->pat.nsteps; i++)
+		total += (u64)c->pat.steps[i].duration_us * NSEC_PER_USEC;
+
+	div64_u64_rem(ktime_to_ns(ktime_sub(now, dev->epoch)), total, &off);
+	for(i = 0; off >= (u64)c->pat.steps[i].duration_us * NSEC_PER_USEC; i++)
+		off -= (u64)c->pat.steps[i].duration_us * NSEC_PER_USEC;
+
+	led_set_idx(dev, idx, c->pat.steps[i].level);
+	c->next = ktime_add_ns(now, (u64)c->pat.steps[i].duration_us * NSEC_PER_USEC - off);
+	c->step = (i + 1) % c->pat.nsteps;
+}
+
+/* 持有dev->lock调用：给第idx个LED安排闪烁模式，nsteps为0时只停止这个LED */
+static long led_sched_set(struct led_device *dev, unsigned int idx, const struct led_pattern *pat, u32 flags)
+{
+	struct led_sched	*c = &dev->sched[idx];
+	ktime_t				now;
+	long				rv;
+
+	if(idx >= dev->nleds || (flags & ~LED_PATTERN_SYNC))
+		return -EINVAL;
+
+	rv = led_check_pattern(dev, pat);
+	if(rv)
+		return rv;
+
+	hrtimer_cancel(&dev->timer);
+	dev->sched_mask &= ~BIT(idx);
+	if(pat->nsteps)
+	{
+		now = ktime_get();
+		if(!dev->sched_mask)
+			dev->epoch = now;	// 时间线空闲时以现在为起点
+
+		c->pat = *pat;
+		c->step = 0;
+		c->loops = 0;
+		c->next = now;		// 马上输出第一步
+		if(flags & LED_PATTERN_SYNC)
+			led_sched_join(dev, idx, now);
+		dev->sched_mask |= BIT(idx);
+	}
+	led_sched_start(dev);
+
+	return 0;
+}
+
+/* 周期内pos之后（不含合并窗口内的边沿）最近的熄灭位置，没有则为周期结束 */
+static u32 led_pwm_next(struct led_device *dev, u32 pos)
+{
+	u32				next = dev->pwm_period_ns;
+	unsigned long	mask = dev->pwm_mask;
+	unsigned int	i;
+
+	for_each_set_bit(i, &mask, LED_MAX)
+	{
+		if(dev->pwm_off_ns[i] > pos + LED_PWM_SLACK_NS && dev->pwm_off_ns[i] < next)
+			next = dev->pwm_off_ns[i];
+	}
+
+	return next;
+}
+
+/* 记录实际周期与设定周期的偏差 */
+static void led_pwm_account(struct led_device *dev, ktime_t now)
+{
+	s64		delta;
+
+	if(dev->pwm_last)
+	{
+		delta = ktime_to_ns(ktime_sub(now, dev->pwm_last)) - dev->pwm_period_ns;
+		if(delta < 0)
+			delta = -delta;
+
+		spin_lock(&dev->stat_lock);
+		dev->pwm_stat.count++;
+		dev->pwm_stat.sum_ns += delta;
+		if(delta > dev->pwm_stat.max_ns)
+			dev->pwm_stat.max_ns = delta;
+		spin_unlock(&dev->stat_lock);
+	}
+	dev->pwm_last = now;
+}
+
+/*
+ * PWM定时器：周期开始时点亮所有PWM中的LED，之后只在有LED需要熄灭的位置醒来，
+ * 熄灭位置相距不超过LED_PWM_SLACK_NS的LED在同一次中断里用一次整组写处理。
+ * 新的占空比只在周期开始时取用，周期中途不会改变其他LED的熄灭时刻。
+ */
+static enum hrtimer_restart led_pwm_timer(struct hrtimer *timer)
+{
+	struct led_device	*dev = container_of(timer, struct led_device, pwm_timer);
+	unsigned long		mask;
+	unsigned long		value = 0;
+	u32					pos = dev->pwm_pos_ns;
+	u32					next;
+	unsigned int		i;
+
+	spin_lock(&dev->pwm_lock);
+	if(pos == 0)
+	{
+		if(dev->pwm_dirty)
+		{
+			dev->pwm_mask = dev->pwm_new_mask;
+			memcpy(dev->pwm_off_ns, dev->pwm_new_off_ns, sizeof(dev->pwm_off_ns));
+			dev->pwm_dirty = false;
+		}
+		if(!dev->pwm_mask)
+		{
+			dev->pwm_running = false;	// 没有LED需要PWM了，下次led_pwm_commit从新的周期开始
+			spin_unlock(&dev->pwm_lock);
+			return HRTIMER_NORESTART;
+		}
+		led_pwm_account(dev, ktime_get());
+		value = dev->pwm_mask;
+	}
+
+	mask = dev->pwm_mask;
+
+	for_each_set_bit(i, &mask, LED_MAX)
+	{
+		if(dev->pwm_off_ns[i] >= pos && dev->pwm_off_ns[i] <= pos + LED_PWM_SLACK_NS)
+			value &= ~BIT(i);
+		else if(pos != 0)
+			mask &= ~BIT(i);	// 不在这次边沿上的LED保持不变
+	}
+	led_bank_write(dev, mask, value);
+
+	next = led_pwm_next(dev, pos);
+	hrtimer_add_expires_ns(timer, next - pos);		// 基于上次到期时间累加，周期不漂移
+	dev->pwm_pos_ns = next < dev->pwm_period_ns ? next : 0;
+	spin_unlock(&dev->pwm_lock);
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * 持有dev->lock调用：按pwm_duty重新计算各LED的熄灭位置。
+ * 定时器在跑时新值留到下一个周期开始再生效，不动共用定时器的相位和抖动统计；
+ * 退出PWM的LED马上从定时器中去掉，调用者接着就可以直接控制它。
+ * 定时器没在跑时从新的周期开始。
+ */
+static void led_pwm_commit(struct led_device *dev)
+{
+	bool			start = false;
+	unsigned int	i;
+
+	spin_lock_irq(&dev->pwm_lock);
+	dev->pwm_new_mask = 0;
+	for(i = 0; i < dev->nleds; i++)
+	{
+		dev->pwm_new_off_ns[i] = div_u64((u64)dev->pwm_period_ns * dev->pwm_duty[i], LED_PWM_DUTY_MAX);
+		if(dev->pwm_duty[i] != 0 && dev->pwm_duty[i] != LED_PWM_DUTY_MAX)
+			dev->pwm_new_mask |= BIT(i);
+	}
+	dev->pwm_mask &= dev->pwm_new_mask;
+
+	if(dev->pwm_running)
+	{
+		dev->pwm_dirty = true;
+	}
+	else if(dev->pwm_new_mask)
+	{
+		dev->pwm_mask = dev->pwm_new_mask;
+		memcpy(dev->pwm_off_ns, dev->pwm_new_off_ns, sizeof(dev->pwm_off_ns));
+		dev->pwm_dirty = false;
+		dev->pwm_pos_ns = 0;
+		dev->pwm_last = 0;
+		dev->pwm_running = true;
+		start = true;
+	}
+	spin_unlock_irq(&dev->pwm_lock);
+
+	if(start)
+		hrtimer_start(&dev->pwm_timer, 0, HRTIMER_MODE_REL);
+}
+
+/* 把第idx个LED从PWM中去掉，改由ioctl或闪烁模式直接控制，其余LED的周期不受影响 */
+static void led_pwm_stop(struct led_device *dev, unsigned int idx)
+{
+	if(!(dev->pwm_new_mask & BIT(idx)))
+		return;
+
+	dev->pwm_duty[idx] = 0;
+	led_pwm_commit(dev);
+}
+
+/* 持有dev->lock调用；只有频率真的变了才停掉定时器，调用者随后用led_pwm_commit从新的周期开始 */
+static int led_pwm_set_freq(struct led_device *dev, u32 freq_hz)
+{
+	if(freq_hz < LED_PWM_FREQ_MIN || freq_hz > LED_PWM_FREQ_MAX)
+		return -EINVAL;
+	if(NSEC_PER_SEC / freq_hz == dev->pwm_period_ns)
+		return 0;
+
+	hrtimer_cancel(&dev->pwm_timer);
+	spin_lock_irq(&dev->pwm_lock);
+	dev->pwm_running = false;
+	dev->pwm_period_ns = NSEC_PER_SEC / freq_hz;
+	spin_unlock_irq(&dev->pwm_lock);
+	spin_lock_irq(&dev->stat_lock);
+	memset(&dev->pwm_stat, 0, sizeof(dev->pwm_stat));	// 换了频率，重新统计抖动
+	spin_unlock_irq(&dev->stat_lock);
+
+	return 0;
+}
+
+/* 持有dev->lock调用；PWM与闪烁模式互斥 */
+static long led_pwm_set(struct led_device *dev, const struct led_pwm *pwm)
+{
+	long	rv;
+
+	if(pwm->led >= dev->nleds || pwm->duty > LED_PWM_DUTY_MAX)
+		return -EINVAL;
+	if(pwm->duty != 0 && pwm->duty != LED_PWM_DUTY_MAX && dev->cansleep)
+		return -EOPNOTSUPP;
+
+	if(pwm->freq_hz)
+	{
+		rv = led_pwm_set_freq(dev, pwm->freq_hz);
+		if(rv)
+			return rv;
+	}
+
+	led_sched_stop(dev, BIT(pwm->led));
+	dev->pwm_duty[pwm->led] = pwm->duty;
+	led_pwm_commit(dev);
+	if(pwm->duty == 0 || pwm->duty == LED_PWM_DUTY_MAX)
+		led_set_idx(dev, pwm->led, pwm->duty != 0);	// 常灭或常亮，不需要定时器
+
+	return 0;
+}
+
+/* LED_SET_PATTERN：第0个LED，立即从第一步开始 */
+static long led_set_pattern(struct led_device *dev, const void __user *uarg)
+{
+	struct led_pattern	*pat;
+	long				rv;
+
+	pat = memdup_user(uarg, sizeof(*pat));
+	if(IS_ERR(pat))
+		return PTR_ERR(pat);
+
+	led_pwm_stop(dev, 0);
+	rv = led_sched_set(dev, 0, pat, 0);
+
+	kfree(pat);
+	return rv;
+}
+
+/* LED_SET_LED_PATTERN：指定LED，可以和其他LED同相 */
+static long led_set_led_pattern(struct led_device *dev, const void __user *uarg)
+{
+	struct led_pattern_ex	*pex;
+	long					rv;
+
+	pex = memdup_user(uarg, sizeof(*pex));
+	if(IS_ERR(pex))
+		return PTR_ERR(pex);
+
+	if(pex->led < dev->nleds)
+		led_pwm_stop(dev, pex->led);
+	rv = led_sched_set(dev, pex->led, &pex->pattern, pex->flags);
+
+	kfree(pex);
+	return rv;
+}
+
+/* 持有dev->lock调用：mask中的LED退出PWM和闪烁模式，随后一次写出整组 */
+static long led_set_bank(struct led_device *dev, const struct led_bank *bank)
+{
+	unsigned long	all = GENMASK(dev->nleds - 1, 0);
+	unsigned long	mask = bank->mask & all;
+	unsigned int	i;
+
+	if(bank->mask & ~all)
+		return -EINVAL;
+
+	led_sched_stop(dev, mask);
+
+	if(dev->pwm_new_mask & mask)
+	{
+		for(i = 0; i < dev->nleds; i++)
+		{
+			if(mask & BIT(i))
+				dev->pwm_duty[i] = 0;
+		}
+		led_pwm_commit(dev);
+	}
+
+	led_bank_write(dev, mask, bank->value);
+	return 0;
+}
+
+/* 持有dev->lock调用 */
+static void led_lat_record(struct led_device *dev, u64 ns)
+{
+	struct led_lat_stat	*lat = &dev->lat;
+
+	if(lat->count == 0 || ns < lat->min_ns)
+		lat->min_ns = ns;
+	if(ns > lat->max_ns)
+		lat->max_ns = ns;
+	lat->count++;
+	lat->sum_ns += ns;
+	lat->hist[min_t(unsigned int, ns ? ilog2(ns) : 0, LED_LAT_BUCKETS - 1)]++;
+}
+
+/*
+ * mmap：偏移idx页映射第idx个LED所在GPIO组的数据寄存器页，用户态一次存储就能翻转引脚。
+ * i.MX6ULL的GPIO没有置位/清零寄存器，只能读-改-写整个DR，会和内核对同组其他引脚的写入竞争，
+ * 所以需要allow_mmap=1并且有CAP_SYS_RAWIO，只用于时序测量。
+ * 找不到i.MX GPIO寄存器时映射一页普通内存，布局相同，用户态程序可以在没有开发板时测试。
+ */
+static void led_mmap_probe(struct led_device *dev)
+{
+	struct gpio_desc	*desc;
+	struct gpio_chip	*chip;
+	struct device_node	*np;
+	struct resource		res;
+	unsigned int		i;
+
+	for(i = 0; i < dev->nleds; i++)
+	{
+		desc = dev->leds->desc[i];
+		chip = gpiod_to_chip(desc);
+		np = chip->parent ? chip->parent->of_node : NULL;
+
+		dev->mmap_info[i].led = i;
+		dev->mmap_info[i].bit = desc_to_gpio(desc) - chip->base;
+		dev->mmap_info[i].flags = gpiod_is_active_low(desc) ? LED_MMAP_ON_HIGH : 0;	// 逻辑0点亮
+
+		if(np && of_device_is_compatible(np, "fsl,imx35-gpio") && !of_address_to_resource(np, 0, &res))
+		{
+			dev->mmap_phys[i] = res.start & PAGE_MASK;
+			dev->mmap_info[i].reg_off = (res.start & ~PAGE_MASK) + LED_GPIO_DR;
+		}
+		else
+		{
+			dev->mmap_info[i].flags |= LED_MMAP_FAKE;
+			dev->mmap_info[i].reg_off = LED_GPIO_DR;
+		}
+	}
+}
+
+static long led_get_mmap_info(struct led_device *dev, struct led_mmap_info __user *uarg)
+{
+	u32		idx;
+
+	if(get_user(idx, &uarg->led))
+		return -EFAULT;
+	if(idx >= dev->nleds)
+		return -EINVAL;
+
+	return copy_to_user(uarg, &dev->mmap_info[idx], sizeof(*uarg)) ? -EFAULT : 0;
 }
 
 static long led_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct led_device	*dev = file->private_data;
+	u64					start = ktime_get_ns();	// 进入驱动的时间，统计到GPIO写完为止
+	struct led_pwm		pwm;
+	struct led_bank		bank;
+	long				rv = 0;
+
+	mutex_lock(&dev->lock);
 	switch(cmd)
 	{
 		case LED_ON: //variable case 变量选择
-			gpiod_set_value(led_dev.led_gpio, 0);
+			led_sched_stop(dev, BIT(0));
+			led_pwm_stop(dev, 0);
+			led_set(dev, true);
 			break;
 		case LED_OFF:
-			gpiod_set_value(led_dev.led_gpio, 1);
+			led_sched_stop(dev, BIT(0));
+			led_pwm_stop(dev, 0);
+			led_set(dev, false);
+			break;
+		case LED_SET_PATTERN:
+			rv = led_set_pattern(dev, (const void __user *)arg);
+			break;
+		case LED_SET_LED_PATTERN:
+			rv = led_set_led_pattern(dev, (const void __user *)arg);
+			break;
+		case LED_SET_PWM:
+			if(copy_from_user(&pwm, (const void __user *)arg, sizeof(pwm)))
+				rv = -EFAULT;
+			else
+				rv = led_pwm_set(dev, &pwm);
+			break;
+		case LED_SET_BANK:
+			if(copy_from_user(&bank, (const void __user *)arg, sizeof(bank)))
+				rv = -EFAULT;
+			else
+				rv = led_set_bank(dev, &bank);
+			break;
+		case LED_GET_COUNT:
+			rv = put_user(dev->nleds, (__u32 __user *)arg);
+			break;
+		case LED_GET_MMAP_INFO:
+			rv = led_get_mmap_info(dev, (struct led_mmap_info __user *)arg);
 			break;
 		default:
 			printk("%s driver don't support ioctl command=%d\n", DEV_NAME, cmd);
 			print_led_help();
-			return -EINVAL;
+			rv = -EINVAL;
+	}
+
+	/* 只统计直接写GPIO的命令，包含等锁和停定时器的时间 */
+	if(rv == 0 && (cmd == LED_ON || cmd == LED_OFF || cmd == LED_SET_BANK))
+		led_lat_record(dev, ktime_get_ns() - start);
+	mutex_unlock(&dev->lock);
+
+	return rv;
+}
+
+/*
+ * sysfs：/sys/class/my_led/my_led/pwm_freq和pwm_duty。
+ * pwm_duty读出所有LED的占空比；写入"duty"设置第0个LED，写入"idx duty"设置第idx个LED。
+ */
+static ssize_t pwm_freq_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", (u32)(NSEC_PER_SEC / led_dev.pwm_period_ns));
+}
+
+static ssize_t pwm_freq_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count)
+{
+	u32		freq_hz;
+	int		rv;
+
+	rv = kstrtou32(buf, 0, &freq_hz);
+	if(rv)
+		return rv;
+
+	/* 只改频率，不影响各LED当前的状态 */
+	mutex_lock(&led_dev.lock);
+	rv = led_pwm_set_freq(&led_dev, freq_hz);
+	if(!rv)
+		led_pwm_commit(&led_dev);
+	mutex_unlock(&led_dev.lock);
+
+	return rv ? rv : count;
+}
+
+static ssize_t pwm_duty_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	ssize_t			len = 0;
+	unsigned int	i;
+
+	for(i = 0; i < led_dev.nleds; i++)
+		len += sprintf(buf + len, "%u%c", led_dev.pwm_duty[i], i + 1 == led_dev.nleds ? '\n' : ' ');
+
+	return len;
+}
+
+static ssize_t pwm_duty_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct led_pwm	pwm = { .led = 0 };
+	int				rv;
+
+	if(sscanf(buf, "%u %u", &pwm.led, &pwm.duty) != 2)
+	{
+		pwm.led = 0;
+		rv = kstrtou32(buf, 0, &pwm.duty);
+		if(rv)
+			return rv;
+	}
+
+	mutex_lock(&led_dev.lock);
+	rv = led_pwm_set(&led_dev, &pwm);
+	mutex_unlock(&led_dev.lock);
+
+	return rv ? rv : count;
+}
+
+static DEVICE_ATTR_RW(pwm_freq);
+static DEVICE_ATTR_RW(pwm_duty);
+
+static struct attribute *led_attrs[] = {
+	&dev_attr_pwm_freq.attr,
+	&dev_attr_pwm_duty.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(led);
+
+/* debugfs：/sys/kernel/debug/my_led/pwm_jitter，实际周期相对设定周期的偏差 */
+static int pwm_jitter_show(struct seq_file *m, void *v)
+{
+	struct led_device	*dev = m->private;
+	struct led_pwm_stat	st;
+
+	spin_lock_irq(&dev->stat_lock);
+	st = dev->pwm_stat;
+	spin_unlock_irq(&dev->stat_lock);
+
+	seq_printf(m, "period_ns: %u\n", dev->pwm_period_ns);
+	seq_printf(m, "periods:   %llu\n", st.count);
+	seq_printf(m, "avg_ns:    %llu\n", st.count ? div64_u64(st.sum_ns, st.count) : 0);
+	seq_printf(m, "max_ns:    %llu\n", st.max_ns);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pwm_jitter);
+
+/*
+ * LED子系统：每个LED注册一个led_classdev，timer/heartbeat/oneshot/netdev等触发器直接调用
+ * brightness_set_blocking，不需要用户态守护进程。亮度0~255映射到软件PWM占空比，
+ * 中间值在GPIO不能用于定时器时按常亮处理。触发器可能在原子上下文中设置亮度，
+ * 只提供blocking接口，LED核心会转到工作队列中调用，这里可以拿dev->lock。
+ */
+static int led_cdev_brightness_set(struct led_classdev *cdev, enum led_brightness value)
+{
+	struct led_pwm	pwm = {
+		.led = cdev - led_dev.led_cdevs,
+		.duty = min_t(u32, value, LED_PWM_DUTY_MAX),
+	};
+	int				rv;
+
+	if(led_dev.cansleep && pwm.duty)
+		pwm.duty = LED_PWM_DUTY_MAX;
+
+	mutex_lock(&led_dev.lock);
+	rv = led_pwm_set(&led_dev, &pwm);
+	mutex_unlock(&led_dev.lock);
+
+	return rv;
+}
+
+static void led_cdev_unregister(struct led_device *dev, unsigned int count)
+{
+	while(count--)
+		led_classdev_unregister(&dev->led_cdevs[count]);
+}
+
+/* 第0个LED使用设备树中的linux,default-trigger，其余默认不挂触发器 */
+static int led_cdev_register(struct led_device *dev, struct device *parent)
+{
+	const char		*trigger = NULL;
+	unsigned int	i;
+	int				rv;
+
+	device_property_read_string(parent, "linux,default-trigger", &trigger);
+
+	for(i = 0; i < dev->nleds; i++)
+	{
+		snprintf(dev->led_names[i], sizeof(dev->led_names[i]), "%s:%u", DEV_NAME, i);
+		dev->led_cdevs[i].name = dev->led_names[i];
+		dev->led_cdevs[i].max_brightness = LED_PWM_DUTY_MAX;
+		dev->led_cdevs[i].brightness_set_blocking = led_cdev_brightness_set;
+		dev->led_cdevs[i].default_trigger = i == 0 ? trigger : NULL;
+
+		rv = led_classdev_register(parent, &dev->led_cdevs[i]);
+		if(rv)
+		{
+			printk("%s driver register LED %s failure: %d\n", DEV_NAME, dev->led_names[i], rv);
+			led_cdev_unregister(dev, i);
+			return rv;
+		}
 	}
+
 	return 0;
 }
 
+/* debugfs：/sys/kernel/debug/my_led/latency，ioctl到GPIO写完的延迟直方图 */
+static int latency_show(struct seq_file *m, void *v)
+{
+	struct led_device	*dev = m->private;
+	struct led_lat_stat	*lat;
+	unsigned int		i;
+
+	lat = kmalloc(sizeof(*lat), GFP_KERNEL);
+	if(!lat)
+		return -ENOMEM;
+
+	mutex_lock(&dev->lock);
+	*lat = dev->lat;
+	mutex_unlock(&dev->lock);
+
+	seq_printf(m, "count:  %llu\n", lat->count);
+	seq_printf(m, "min_ns: %llu\n", lat->min_ns);
+	seq_printf(m, "max_ns: %llu\n", lat->max_ns);
+	seq_printf(m, "avg_ns: %llu\n", lat->count ? div64_u64(lat->sum_ns, lat->count) : 0);
+	for(i = 0; i < LED_LAT_BUCKETS; i++)
+	{
+		if(lat->hist[i])
+			seq_printf(m, "[%10llu, %10llu) ns: %llu\n", i ? 1ULL << i : 0, 1ULL << (i + 1), lat->hist[i]);
+	}
+
+	kfree(lat);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+/* 向latency_reset写入任意内容清空统计 */
+static ssize_t latency_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct led_device	*dev = file->private_data;
+
+	mutex_lock(&dev->lock);
+	memset(&dev->lat, 0, sizeof(dev->lat));
+	mutex_unlock(&dev->lock);
+
+	return count;
+}
+
+static const struct file_operations latency_reset_fops = {
+	.owner	=	THIS_MODULE,
+	.open	=	simple_open,
+	.write	=	latency_reset_write,
+	.llseek	=	noop_llseek,
+};
+
+/* 每次只映射一个LED的一页，寄存器页不经过cache */
+static int led_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct led_device	*dev = file->private_data;
+	unsigned long		idx = vma->vm_pgoff;
+	int					rv = 0;
+
+	if(!allow_mmap)
+		return -EPERM;
+	if(!capable(CAP_SYS_RAWIO))
+		return -EPERM;
+	if(idx >= dev->nleds || vma_pages(vma) != 1)
+		return -EINVAL;
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;		// 私有映射写时复制，写不到寄存器上
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+
+	if(dev->mmap_phys[idx])
+	{
+		vma->vm_flags |= VM_IO;
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);	// 寄存器不能经过cache
+		return io_remap_pfn_range(vma, vma->vm_start, dev->mmap_phys[idx] >> PAGE_SHIFT,
+				PAGE_SIZE, vma->vm_page_prot);
+	}
+
+	mutex_lock(&dev->lock);
+	if(!dev->fake_page)
+		dev->fake_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if(!dev->fake_page)
+		rv = -ENOMEM;
+	else
+		rv = vm_insert_page(vma, vma->vm_start, dev->fake_page);	// 映射持有页的引用，卸载驱动后仍然有效
+	mutex_unlock(&dev->lock);
+
+	return rv;
+}
+
 /* 字符设备操作函数集 */
 static struct file_operations led_fops = {
 	.owner = THIS_MODULE,
 	.open = led_open,
 	.release = led_release,
 	.unlocked_ioctl = led_ioctl,
+	.mmap = led_mmap,
 };
 
 /* probe函数实现字符设备的注册和LED灯的初始化 */
 static int led_probe(struct platform_device *pdev)
 {
-	int		result = 0;		//用于保存申请的设备号结果
+	int				result = 0;		//用于保存申请的设备号结果
+	unsigned int	i;
 
 	printk("\t  match successed  \n");
 
 	memset(&led_dev, 0, sizeof(led_dev));
+	mutex_init(&led_dev.lock);
+	hrtimer_init(&led_dev.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	led_dev.timer.function = led_sched_timer;
+	hrtimer_init(&led_dev.pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	led_dev.pwm_timer.function = led_pwm_timer;
+	spin_lock_init(&led_dev.stat_lock);
+	spin_lock_init(&led_dev.pwm_lock);
+	led_dev.pwm_period_ns = NSEC_PER_SEC / LED_PWM_FREQ_DEF;
+	spin_lock_init(&led_dev.gpio_lock);
 
-	/* 获取led的设备树节点 */
-	led_dev.led_gpio = gpiod_get(&pdev->dev, "led", 0);// 请求gpio，有请求一定要有释放，否则模块下一次安装将请求失败
-	if(IS_ERR(led_dev.led_gpio))
+	/* 获取led的设备树节点，led-gpios可以列出多个GPIO */
+	led_dev.leds = gpiod_get_array(&pdev->dev, "led", GPIOD_OUT_LOW);// 请求gpio并设为输出，默认电平为低；有请求一定要有释放，否则模块下一次安装将请求失败
+	if(IS_ERR(led_dev.leds))
 	{
 		printk("gpiod request failure\n");
-		return PTR_ERR(led_dev.led_gpio);
+		return PTR_ERR(led_dev.leds);
 	}
 
-	result = gpiod_direction_output(led_dev.led_gpio, 0); //设置GPIO的方向为输出，默认电平为低
-	if(result != 0)
+	if(led_dev.leds->ndescs > LED_MAX)
 	{
-		printk("gpiod direction output set failure\n");
-		return result;
+		printk("%s driver support at most %d LEDs\n", DEV_NAME, LED_MAX);
+		gpiod_put_array(led_dev.leds);
+		return -EINVAL;
 	}
+	led_dev.nleds = led_dev.leds->ndescs;
+	led_dev.state = GENMASK(led_dev.nleds - 1, 0);	// 低电平点亮
+	for(i = 0; i < led_dev.nleds; i++)
+	{
+		if(gpiod_cansleep(led_dev.leds->desc[i]))
+			led_dev.cansleep = true;
+	}
+	led_mmap_probe(&led_dev);
 
 	/* ----------------------------注册 字符设备部分-------------------------------- */
 	/* 1. 分配主次设备号，这里既支持静态指定，也支持动态分配 */
@@ -142,7 +1022,7 @@ static int led_probe(struct platform_device *pdev)
 	if(result < 0)
 	{
 		printk(" %s driver can't get major %d\n", DEV_NAME, dev_major);
-		return result;
+		goto PUT_GPIO;
 	}
 	printk(" %s driver use major %d\n", DEV_NAME, dev_major);
 
@@ -169,26 +1049,49 @@ static int led_probe(struct platform_device *pdev)
 	}
 
 	/* 4. 创建设备 */
-	led_dev.device = device_create(led_dev.class, NULL, led_dev.devid, NULL, DEV_NAME); /* /dev/my_led 创建设备节点 */
+	led_dev.device = device_create_with_groups(led_dev.class, NULL, led_dev.devid, NULL, led_groups, DEV_NAME); /* /dev/my_led 创建设备节点，同时创建sysfs属性 */
 	if(IS_ERR(led_dev.device))
 	{
 		result = -ENOMEM;	// 返回错误码，应用空间strerror查看
 		goto ERROR;
 	}
 
+	/* 5. 注册到LED子系统，与字符设备并存 */
+	result = led_cdev_register(&led_dev, &pdev->dev);
+	if(result != 0)
+	{
+		device_destroy(led_dev.class, led_dev.devid);
+		class_destroy(led_dev.class);
+		goto ERROR;
+	}
+
+	/* 6. 调试信息，创建失败不影响驱动使用 */
+	led_dev.debugfs = debugfs_create_dir(DEV_NAME, NULL);
+	debugfs_create_file("pwm_jitter", 0444, led_dev.debugfs, &led_dev, &pwm_jitter_fops);
+	debugfs_create_file("latency", 0444, led_dev.debugfs, &led_dev, &latency_fops);
+	debugfs_create_file("latency_reset", 0200, led_dev.debugfs, &led_dev, &latency_reset_fops);
+
 	return 0;
 
 ERROR:
 	printk(KERN_ERR" %s driver installed failure.\n", DEV_NAME);
 	cdev_del(&(led_dev.cdev));	// 删除字符设备
 	unregister_chrdev_region(led_dev.devid, 1);	//释放主次设备号
+PUT_GPIO:
+	gpiod_put_array(led_dev.leds);	// 释放gpio，否则下一次insmod请求不到
 	return result;
 }
 
 static int led_remove(struct platform_device *pdev)
 {
-	gpiod_set_value(led_dev.led_gpio, 0);	//低电平关闭灯
-	gpiod_put(led_dev.led_gpio);			//释放gpio
+	led_cdev_unregister(&led_dev, led_dev.nleds);	//先注销LED子系统，之后不会再有触发器写GPIO
+	debugfs_remove_recursive(led_dev.debugfs);
+	hrtimer_cancel(&led_dev.timer);			//停止闪烁模式
+	hrtimer_cancel(&led_dev.pwm_timer);		//停止PWM
+	led_bank_write(&led_dev, GENMASK(led_dev.nleds - 1, 0), GENMASK(led_dev.nleds - 1, 0));	//全部输出低电平
+	gpiod_put_array(led_dev.leds);			//释放gpio
+	if(led_dev.fake_page)
+		put_page(led_dev.fake_page);		//还被映射时等munmap后才真正释放
 
 	cdev_del(&(led_dev.cdev));				//删除cdev
 	unregister_chrdev_region(led_dev.devid, 1); //释放设备号
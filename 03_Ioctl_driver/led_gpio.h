@@ -0,0 +1,108 @@
+/********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  led_gpio.h
+ *    Description:  LED驱动与应用程序共用的ioctl命令和数据结构
+ *
+ *        Version:  1.0.0(2023年04月21日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年04月21日 07时37分24秒"
+ *
+ ********************************************************************************/
+
+#ifndef _LED_GPIO_H_
+#define _LED_GPIO_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PLATDRV_MAGIC			0x60	//魔术字
+#define LED_OFF					_IO (PLATDRV_MAGIC, 0x18)
+#define LED_ON					_IO (PLATDRV_MAGIC, 0x19)
+
+/*
+ * 闪烁模式：驱动用hrtimer依次播放steps，每步把LED设为level并保持duration_us微秒，
+ * 播完nsteps步算一遍，共播repeat遍（0为无限循环），结束后保持最后一步的电平。
+ * nsteps为0表示停止播放；LED_ON/LED_OFF也会停止正在播放的模式。
+ */
+#define LED_PATTERN_MAX			64
+#define LED_STEP_MIN_US			50		// 每步最短时间，防止定时器中断占满CPU
+
+struct led_step {
+	__u32	level;			// 非0为亮
+	__u32	duration_us;
+};
+
+struct led_pattern {
+	__u32			nsteps;
+	__u32			repeat;
+	struct led_step	steps[LED_PATTERN_MAX];
+};
+
+#define LED_SET_PATTERN			_IOW(PLATDRV_MAGIC, 0x1a, struct led_pattern)
+
+/*
+ * 软件PWM调光：duty为0~255，0常灭、255常亮，其余由驱动的hrtimer按freq_hz输出PWM。
+ * 频率对所有LED生效，freq_hz为0表示不修改频率。设置PWM会停止正在播放的闪烁模式。
+ */
+#define LED_PWM_DUTY_MAX		255
+#define LED_PWM_FREQ_MIN		1
+#define LED_PWM_FREQ_MAX		10000
+#define LED_PWM_FREQ_DEF		200
+
+struct led_pwm {
+	__u32	led;			// LED序号
+	__u32	freq_hz;
+	__u32	duty;
+	__u32	reserved;
+};
+
+#define LED_SET_PWM				_IOW(PLATDRV_MAGIC, 0x1b, struct led_pwm)
+
+/*
+ * 整组更新：设备树led-gpios中的第i个LED对应bit i，mask中的LED设为value对应bit的亮灭，
+ * 驱动用一次gpiod_set_array_value写出，同一组GPIO同时变化。LED_ON/LED_OFF只控制第0个LED。
+ */
+struct led_bank {
+	__u32	mask;
+	__u32	value;			// bit为1表示亮
+};
+
+#define LED_SET_BANK			_IOW(PLATDRV_MAGIC, 0x1c, struct led_bank)
+#define LED_GET_COUNT			_IOR(PLATDRV_MAGIC, 0x1d, __u32)
+
+/*
+ * 给指定LED安排闪烁模式，所有LED的模式在驱动中共用一个定时器，同时发生的变化一次写出。
+ * 设置LED_PATTERN_SYNC时按照从时间线起点一直播放的相位加入，1Hz/2Hz/4Hz等倍数关系的LED保持同相；
+ * 否则马上从第一步开始。LED_SET_PATTERN等价于led为0、flags为0。
+ */
+#define LED_PATTERN_SYNC		0x1
+
+struct led_pattern_ex {
+	__u32				led;
+	__u32				flags;
+	struct led_pattern	pattern;
+};
+
+#define LED_SET_LED_PATTERN		_IOW(PLATDRV_MAGIC, 0x1e, struct led_pattern_ex)
+
+/*
+ * 寄存器直接映射（需要insmod时allow_mmap=1，并且有CAP_SYS_RAWIO）：
+ * 先用LED_GET_MMAP_INFO查询第led个LED，再mmap一页、偏移为led*页大小，
+ * 页内reg_off处的32位数据寄存器中bit位对应这个LED。硬件没有置位/清零寄存器，只能读-改-写，
+ * 不要和驱动同时操作同一组的其他引脚。LED_MMAP_FAKE表示映射的是普通内存，用于没有开发板时测试。
+ */
+#define LED_MMAP_ON_HIGH		0x1		// 高电平点亮，否则低电平点亮
+#define LED_MMAP_FAKE			0x2
+
+struct led_mmap_info {
+	__u32	led;			// 输入
+	__u32	reg_off;
+	__u32	bit;
+	__u32	flags;
+};
+
+#define LED_GET_MMAP_INFO		_IOWR(PLATDRV_MAGIC, 0x1f, struct led_mmap_info)
+
+#endif
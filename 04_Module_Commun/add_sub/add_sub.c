@@ -14,8 +14,20 @@
 
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/math64.h>
+#if defined(CONFIG_ARM) && defined(CONFIG_KERNEL_MODE_NEON)
+#include <asm/neon.h>
+#include <asm/simd.h>
+#define ADD_SUB_NEON	1
+#endif
 #include "add_sub.h"
 
+#define ADD_SUB_NEON_BLOCK		8		/* NEON循环每次处理8个s32（两个q寄存器） */
+#define ADD_SUB_NEON_MIN		32		/* 少于这么多元素时保存/恢复NEON状态不划算，直接走通用代码 */
+#define ADD_SUB_NEON_CHUNK		4096	/* 每次kernel_neon_begin最多处理的元素数，限制关抢占的时间 */
+
 long add_integer(long a, long b)			//函数返回a+b的和
 {
 	return a+b;
@@ -26,8 +38,198 @@ long sub_integer(long a, long b)			//函数返回a和b的差
 	return a-b;
 }
 
+/*
+ * 批量运算的NEON实现，只处理ADD_SUB_NEON_BLOCK整数倍的部分，剩下的尾部由通用代码完成。
+ * 内核本身不使用浮点/NEON编译，所以用内联汇编加.fpu neon，不需要改Makefile的编译选项。
+ */
+#ifdef ADD_SUB_NEON
+typedef void (*add_sub_neon_fn)(s32 *dst, const s32 *a, const s32 *b, size_t blocks);
+
+#define ADD_SUB_NEON_OP(name, insn)										\
+static void name(s32 *dst, const s32 *a, const s32 *b, size_t blocks)	\
+{																		\
+	asm volatile(														\
+		"	.fpu	neon\n"												\
+		"1:	vld1.32	{q0-q1}, [%1]!\n"									\
+		"	vld1.32	{q2-q3}, [%2]!\n"									\
+		"	" insn "	q0, q0, q2\n"										\
+		"	" insn "	q1, q1, q3\n"										\
+		"	vst1.32	{q0-q1}, [%0]!\n"									\
+		"	subs	%3, %3, #1\n"											\
+		"	bne		1b\n"													\
+		: "+r" (dst), "+r" (a), "+r" (b), "+r" (blocks)					\
+		:																\
+		: "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "cc", "memory");	\
+}
+
+ADD_SUB_NEON_OP(neon_add_s32, "vadd.i32")
+ADD_SUB_NEON_OP(neon_sub_s32, "vsub.i32")
+ADD_SUB_NEON_OP(neon_qadd_s32, "vqadd.s32")
+ADD_SUB_NEON_OP(neon_qsub_s32, "vqsub.s32")
+
+/* 两路64位累加器，vpadal把相邻两个s32加宽后累加，不会溢出 */
+static s64 neon_sum_s32(const s32 *a, size_t blocks)
+{
+	u32		lo, hi;
+
+	asm volatile(
+		"	.fpu	neon\n"
+		"	vmov.i64	q8, #0\n"
+		"	vmov.i64	q9, #0\n"
+		"1:	vld1.32	{q0-q1}, [%2]!\n"
+		"	vpadal.s32	q8, q0\n"
+		"	vpadal.s32	q9, q1\n"
+		"	subs	%3, %3, #1\n"
+		"	bne		1b\n"
+		"	vadd.i64	q8, q8, q9\n"
+		"	vadd.i64	d16, d16, d17\n"
+		"	vmov	%0, %1, d16\n"
+		: "=&r" (lo), "=&r" (hi), "+r" (a), "+r" (blocks)
+		:
+		: "d0", "d1", "d2", "d3", "d16", "d17", "d18", "d19", "cc", "memory");
+
+	return (s64)(((u64)hi << 32) | lo);
+}
+
+/* 分块调用NEON实现，返回已经处理的元素个数 */
+static size_t add_sub_neon_run(add_sub_neon_fn fn, s32 *dst, const s32 *a, const s32 *b, size_t n)
+{
+	size_t		done = 0, chunk;
+
+	if(n < ADD_SUB_NEON_MIN || !may_use_simd())
+		return 0;
+
+	while(n - done >= ADD_SUB_NEON_BLOCK)
+	{
+		chunk = min_t(size_t, n - done, ADD_SUB_NEON_CHUNK) & ~(size_t)(ADD_SUB_NEON_BLOCK - 1);
+		kernel_neon_begin();
+		fn(dst + done, a + done, b + done, chunk / ADD_SUB_NEON_BLOCK);
+		kernel_neon_end();
+		done += chunk;
+	}
+
+	return done;
+}
+#else
+#define add_sub_neon_run(fn, dst, a, b, n)	0
+#endif
+
+void add_integer_array(s32 *dst, const s32 *a, const s32 *b, size_t n)		//dst[i] = a[i] + b[i]，溢出回绕
+{
+	size_t		i = add_sub_neon_run(neon_add_s32, dst, a, b, n);
+
+	for(; i < n; i++)
+		dst[i] = a[i] + b[i];
+}
+
+void sub_integer_array(s32 *dst, const s32 *a, const s32 *b, size_t n)		//dst[i] = a[i] - b[i]，溢出回绕
+{
+	size_t		i = add_sub_neon_run(neon_sub_s32, dst, a, b, n);
+
+	for(; i < n; i++)
+		dst[i] = a[i] - b[i];
+}
+
+void add_integer_array_sat(s32 *dst, const s32 *a, const s32 *b, size_t n)	//饱和加法，结果限制在S32_MIN~S32_MAX
+{
+	size_t		i = add_sub_neon_run(neon_qadd_s32, dst, a, b, n);
+
+	for(; i < n; i++)
+		dst[i] = clamp_t(s64, (s64)a[i] + b[i], S32_MIN, S32_MAX);
+}
+
+void sub_integer_array_sat(s32 *dst, const s32 *a, const s32 *b, size_t n)	//饱和减法
+{
+	size_t		i = add_sub_neon_run(neon_qsub_s32, dst, a, b, n);
+
+	for(; i < n; i++)
+		dst[i] = clamp_t(s64, (s64)a[i] - b[i], S32_MIN, S32_MAX);
+}
+
+s64 sum_integer_array(const s32 *a, size_t n)		//返回所有元素之和，64位累加不会溢出
+{
+	s64			sum = 0;
+	size_t		i = 0;
+#ifdef ADD_SUB_NEON
+	size_t		chunk;
+
+	if(n >= ADD_SUB_NEON_MIN && may_use_simd())
+	{
+		while(n - i >= ADD_SUB_NEON_BLOCK)
+		{
+			chunk = min_t(size_t, n - i, ADD_SUB_NEON_CHUNK) & ~(size_t)(ADD_SUB_NEON_BLOCK - 1);
+			kernel_neon_begin();
+			sum += neon_sum_s32(a + i, chunk / ADD_SUB_NEON_BLOCK);
+			kernel_neon_end();
+			i += chunk;
+		}
+	}
+#endif
+
+	for(; i < n; i++)
+		sum += a[i];
+
+	return sum;
+}
+
+/*
+ * 定点换算：传感器原始值直接换算成千分之一单位的整数，系数在编译时算好，运行时只有整数乘法和移位。
+ */
+#define SHT2X_STATUS_MASK		0x0003				/* 原始值最低两位是状态位 */
+#define SHT2X_T_SLOPE			175720				/* 175.72 'C * 1000 / 2^16 */
+#define SHT2X_T_OFFSET			(-46850)			/* -46.85 'C * 1000 */
+#define SHT2X_RH_SLOPE			125000				/* 125 %RH * 1000 / 2^16 */
+#define SHT2X_RH_OFFSET			(-6000)				/* -6 %RH * 1000 */
+#define SHT2X_SHIFT				16
+
+#define DS18B20_LSB_MILLI_NUM	125					/* 1 LSB = 0.0625 'C = 125/2 m'C */
+#define DS18B20_LSB_MILLI_DEN	2
+
+s32 scale_integer(s32 x, s32 mul, s32 div)		//返回x*mul/div，四舍五入（远离0），div为0时返回0
+{
+	s64		n = (s64)x * mul;
+
+	if(div == 0)
+		return 0;
+	if(div < 0)
+	{
+		n = -n;
+		div = -div;
+	}
+
+	return n >= 0 ? div_s64(n + div / 2, div) : -div_s64(-n + div / 2, div);
+}
+
+s32 sht2x_temp_milli(u16 raw)		//SHT2x温度原始值换算为m'C
+{
+	u32		s = raw & ~SHT2X_STATUS_MASK;
+
+	return SHT2X_T_OFFSET + (s32)(((u64)s * SHT2X_T_SLOPE + (1u << (SHT2X_SHIFT - 1))) >> SHT2X_SHIFT);
+}
+
+s32 sht2x_rh_milli(u16 raw)			//SHT2x湿度原始值换算为千分之一%RH
+{
+	u32		s = raw & ~SHT2X_STATUS_MASK;
+
+	return SHT2X_RH_OFFSET + (s32)(((u64)s * SHT2X_RH_SLOPE + (1u << (SHT2X_SHIFT - 1))) >> SHT2X_SHIFT);
+}
+
+s32 ds18b20_temp_milli(u16 raw)		//DS18B20温度寄存器（补码，1/16 'C）换算为m'C，保留符号
+{
+	return scale_integer((s16)raw, DS18B20_LSB_MILLI_NUM, DS18B20_LSB_MILLI_DEN);
+}
+
 EXPORT_SYMBOL(add_integer);				//导出加法函数
 EXPORT_SYMBOL(sub_integer);			//导出减法函数
+EXPORT_SYMBOL(add_integer_array);
+EXPORT_SYMBOL(sub_integer_array);
+EXPORT_SYMBOL(add_integer_array_sat);
+EXPORT_SYMBOL(sub_integer_array_sat);
+EXPORT_SYMBOL(sum_integer_array);
+EXPORT_SYMBOL(scale_integer);
+EXPORT_SYMBOL(sht2x_temp_milli);
+EXPORT_SYMBOL(sht2x_rh_milli);
+EXPORT_SYMBOL(ds18b20_temp_milli);
 
 MODULE_LICENSE("Dual BSD/GPL");
 MODULE_AUTHOR("NongJieYing <njy_roxy@outlook.com>");
@@ -0,0 +1,29 @@
+/********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  crc8_sensor.h
+ *    Description:  传感器驱动共用的查表CRC-8
+ *
+ *        Version:  1.0.0(2023年05月02日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年05月02日 09时13分05秒"
+ *                 
+ ********************************************************************************/
+
+#ifndef _CRC8_SENSOR_H_
+#define _CRC8_SENSOR_H_
+
+#include <linux/types.h>
+
+#define SENSOR_CRC8_SENSIRION_INIT		0x00
+#define SENSOR_CRC8_MAXIM_INIT			0x00
+
+/*
+ * 计算len字节的CRC-8，crc为初值，也可以传入上一段的结果分段计算。
+ * sensirion：多项式0x31高位先出，用于SHT2x；maxim：反射多项式0x8C低位先出，用于DS18B20等1-Wire器件。
+ */
+u8 sensor_crc8_sensirion(const u8 *data, size_t len, u8 crc);
+u8 sensor_crc8_maxim(const u8 *data, size_t len, u8 crc);
+
+#endif
@@ -0,0 +1,145 @@
+/*********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  dsp_filter.c
+ *    Description:  传感器采样用的定点滤波器库，导出给DS18B20和SHT20驱动使用
+ *                 
+ *        Version:  1.0.0(2023年05月03日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年05月03日 10时25分42秒"
+ *                 
+ ********************************************************************************/
+
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include "dsp_filter.h"
+
+/* s64右移并四舍五入，内核中有符号数右移为算术移位 */
+static inline s64 dsp_round_shift(s64 v, unsigned int shift)
+{
+	return shift ? (v + (1LL << (shift - 1))) >> shift : v;
+}
+
+int dsp_median_init(struct dsp_median *f, unsigned int len)
+{
+	if(len == 0 || len > DSP_MEDIAN_MAX)
+		return -EINVAL;
+
+	memset(f, 0, sizeof(*f));
+	f->len = len;
+	return 0;
+}
+
+s32 dsp_median_update(struct dsp_median *f, s32 x)		//返回加入x后窗口内的中值，偶数个样本取两个中间值的平均
+{
+	s32		tmp[DSP_MEDIAN_MAX];
+	s32		v;
+	int		i, j;
+
+	f->buf[f->pos] = x;
+	f->pos = (f->pos + 1) % f->len;
+	if(f->count < f->len)
+		f->count++;
+
+	/* 窗口最多7个样本，插入排序比维护有序结构更快 */
+	for(i = 0; i < f->count; i++)
+	{
+		v = f->buf[i];
+		for(j = i; j > 0 && tmp[j - 1] > v; j--)
+			tmp[j] = tmp[j - 1];
+		tmp[j] = v;
+	}
+
+	if(f->count & 1)
+		return tmp[f->count / 2];
+
+	return dsp_round_shift((s64)tmp[f->count / 2 - 1] + tmp[f->count / 2], 1);
+}
+
+int dsp_ema_init(struct dsp_ema *f, unsigned int shift)
+{
+	if(shift > DSP_EMA_SHIFT_MAX)
+		return -EINVAL;
+
+	memset(f, 0, sizeof(*f));
+	f->shift = shift;
+	return 0;
+}
+
+s32 dsp_ema_update(struct dsp_ema *f, s32 x)
+{
+	if(!f->primed)
+	{
+		f->acc = (s64)x << f->shift;
+		f->primed = true;
+		return x;
+	}
+
+	f->acc += x - dsp_round_shift(f->acc, f->shift);
+
+	return dsp_round_shift(f->acc, f->shift);
+}
+
+void dsp_biquad_init(struct dsp_biquad *f, const struct dsp_biquad_coef *c)
+{
+	memset(f, 0, sizeof(*f));
+	f->c = *c;
+}
+
+s32 dsp_biquad_update(struct dsp_biquad *f, s32 x)
+{
+	s64		acc;
+	s32		y;
+
+	acc = (s64)f->c.b0 * x + (s64)f->c.b1 * f->x1 + (s64)f->c.b2 * f->x2
+		- (s64)f->c.a1 * f->y1 - (s64)f->c.a2 * f->y2;
+	y = clamp_t(s64, dsp_round_shift(acc, DSP_BIQUAD_SHIFT), S32_MIN, S32_MAX);
+
+	f->x2 = f->x1;
+	f->x1 = x;
+	f->y2 = f->y1;
+	f->y1 = y;
+
+	return y;
+}
+
+int dsp_decim_init(struct dsp_decim *f, unsigned int factor)
+{
+	if(factor == 0 || factor > U16_MAX)
+		return -EINVAL;
+
+	memset(f, 0, sizeof(*f));
+	f->factor = factor;
+	return 0;
+}
+
+bool dsp_decim_update(struct dsp_decim *f, s32 x, s32 *out)
+{
+	f->sum += x;
+	if(++f->count < f->factor)
+		return false;
+
+	/* 平均值四舍五入，远离0 */
+	*out = f->sum >= 0 ? div_s64(f->sum + f->factor / 2, f->factor) : -div_s64(-f->sum + f->factor / 2, f->factor);
+	f->sum = 0;
+	f->count = 0;
+	return true;
+}
+
+EXPORT_SYMBOL(dsp_median_init);
+EXPORT_SYMBOL(dsp_median_update);
+EXPORT_SYMBOL(dsp_ema_init);
+EXPORT_SYMBOL(dsp_ema_update);
+EXPORT_SYMBOL(dsp_biquad_init);
+EXPORT_SYMBOL(dsp_biquad_update);
+EXPORT_SYMBOL(dsp_decim_init);
+EXPORT_SYMBOL(dsp_decim_update);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("NongJieYing <njy_roxy@outlook.com>");
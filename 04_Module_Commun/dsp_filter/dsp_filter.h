@@ -0,0 +1,80 @@
+/********************************************************************************
+ *      Copyright:  (C) 2023 Noah<njy_roxy@outlook.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  dsp_filter.h
+ *    Description:  传感器采样用的定点滤波器：滑动中值、EMA、双二阶IIR、抽取
+ *
+ *        Version:  1.0.0(2023年05月03日)
+ *         Author:  Noah <njy_roxy@outlook.com>
+ *      ChangeLog:  1, Release initial version on "2023年05月03日 10时26分14秒"
+ *                 
+ ********************************************************************************/
+
+#ifndef _DSP_FILTER_H_
+#define _DSP_FILTER_H_
+
+#include <linux/types.h>
+
+/*
+ * 所有滤波器都以s32为样本（例如m'C），状态结构体由驱动嵌入自己的私有结构体，
+ * 先调用对应的init，然后每来一个样本调用一次update。函数本身不加锁，由调用者保护状态。
+ */
+
+/* 滑动中值：最近len个样本的中值，len为1~DSP_MEDIAN_MAX，去掉偶发的尖峰 */
+#define DSP_MEDIAN_MAX			7
+
+struct dsp_median {
+	s32		buf[DSP_MEDIAN_MAX];
+	u8		len;
+	u8		pos;
+	u8		count;		// 已有样本数，不满len时取已有样本的中值
+};
+
+int dsp_median_init(struct dsp_median *f, unsigned int len);
+s32 dsp_median_update(struct dsp_median *f, s32 x);
+
+/* 指数滑动平均：y += (x - y) / 2^shift，shift为0~16，内部多保留shift位小数避免截断偏差 */
+#define DSP_EMA_SHIFT_MAX		16
+
+struct dsp_ema {
+	s64		acc;		// y * 2^shift
+	u8		shift;
+	bool	primed;		// 第一个样本直接作为初值
+};
+
+int dsp_ema_init(struct dsp_ema *f, unsigned int shift);
+s32 dsp_ema_update(struct dsp_ema *f, s32 x);
+
+/*
+ * 双二阶IIR（直接I型）：y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2，系数为Q14定点（a0归一化为1）。
+ * DSP_Q14()只用于把编译时的常数系数转换成定点，不要在运行时传入变量。
+ */
+#define DSP_BIQUAD_SHIFT		14
+#define DSP_Q14(x)				((s32)((x) * (1 << DSP_BIQUAD_SHIFT) + ((x) >= 0 ? 0.5 : -0.5)))
+
+struct dsp_biquad_coef {
+	s32		b0, b1, b2;
+	s32		a1, a2;
+};
+
+struct dsp_biquad {
+	struct dsp_biquad_coef	c;
+	s32		x1, x2;
+	s32		y1, y2;
+};
+
+void dsp_biquad_init(struct dsp_biquad *f, const struct dsp_biquad_coef *c);
+s32 dsp_biquad_update(struct dsp_biquad *f, s32 x);
+
+/* 抽取：每factor个样本输出一次平均值，update返回true时*out有效 */
+struct dsp_decim {
+	s64		sum;
+	u16		factor;
+	u16		count;
+};
+
+int dsp_decim_init(struct dsp_decim *f, unsigned int factor);
+bool dsp_decim_update(struct dsp_decim *f, s32 x, s32 *out);
+
+#endif
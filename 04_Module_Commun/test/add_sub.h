@@ -14,7 +14,29 @@
 #ifndef _ADD_SUB_H_
 #define _ADD_SUB_H_
 
+#include <linux/types.h>
+
 long add_integer(long a, long b);
 long sub_integer(long a, long b);
 
+/*
+ * 批量运算：对n个元素逐个计算，dst可以和a或b是同一个数组。
+ * ARM上开启CONFIG_KERNEL_MODE_NEON时用NEON一次处理8个元素，否则为普通循环；
+ * 在中断上下文中也可以调用，此时不使用NEON。
+ */
+void add_integer_array(s32 *dst, const s32 *a, const s32 *b, size_t n);
+void sub_integer_array(s32 *dst, const s32 *a, const s32 *b, size_t n);
+void add_integer_array_sat(s32 *dst, const s32 *a, const s32 *b, size_t n);
+void sub_integer_array_sat(s32 *dst, const s32 *a, const s32 *b, size_t n);
+s64 sum_integer_array(const s32 *a, size_t n);
+
+/*
+ * 定点换算：返回千分之一单位的整数（m'C、千分之一%RH），不需要浮点。
+ * raw为传感器寄存器的原始16位值，SHT2x的低两位状态位由函数清掉。
+ */
+s32 scale_integer(s32 x, s32 mul, s32 div);
+s32 sht2x_temp_milli(u16 raw);
+s32 sht2x_rh_milli(u16 raw);
+s32 ds18b20_temp_milli(u16 raw);
+
 #endif
@@ -14,11 +14,296 @@
 
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/preempt.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
 #include "add_sub.h"
+#include "crc8_sensor.h"
+
+/*
+ * 微基准：echo 1 > /sys/kernel/debug/add_sub_test/bench 跑一轮，cat同一个文件看结果，
+ * 改/sys/module/test/parameters/下的iterations、veclen后可以直接再跑，不用重新加载模块。
+ * 每段只跑BENCH_SLICE次调用或一遍向量，段内关抢占计时，段之间cond_resched，
+ * 测到的时间不包含被调度出去的时间，也不会因为长时间关抢占触发soft lockup。
+ * 向量测试每个op是一个s32元素，CRC测试同样按4字节算一个op。
+ */
+#define BENCH_NAME			"add_sub_test"
+#define BENCH_SLICE			4096
+#define BENCH_VECLEN_MAX	(1 << 20)
+#define BENCH_REPORT_LEN	2048
 
 static long a =1;
 static long b =1;
 static int AddOrSub = 1;
+static unsigned long iterations = 1000000;	//每项测试的总运算次数
+static unsigned int veclen = 1024;			//批量测试的向量长度
+
+struct bench_vec {
+	s32				*a;
+	s32				*b;
+	s32				*dst;
+	unsigned int	n;
+	s64				sink;		//保存结果，防止编译器把运算优化掉
+};
+
+struct bench_case {
+	const char		*name;
+	void			(*fn)(struct bench_vec *v);
+	bool			vector;		//true每段处理一遍向量，false每段BENCH_SLICE次调用
+};
+
+static DEFINE_MUTEX(bench_lock);
+static char bench_report[BENCH_REPORT_LEN];
+static size_t bench_len;
+static struct dentry *bench_dir;
+
+static inline long inline_add(long x, long y)		//同一模块内可以内联的加法，对比跨模块调用
+{
+	return x + y;
+}
+
+static void bench_add_integer(struct bench_vec *v)
+{
+	long			acc = 0;
+	unsigned int	i;
+
+	for(i = 0; i < BENCH_SLICE; i++)
+		acc = add_integer(acc, i);
+	v->sink += acc;
+}
+
+static void bench_sub_integer(struct bench_vec *v)
+{
+	long			acc = 0;
+	unsigned int	i;
+
+	for(i = 0; i < BENCH_SLICE; i++)
+		acc = sub_integer(acc, i);
+	v->sink += acc;
+}
+
+static void bench_inline_add(struct bench_vec *v)
+{
+	long			acc = 0;
+	unsigned int	i;
+
+	for(i = 0; i < BENCH_SLICE; i++)
+	{
+		acc = inline_add(acc, i);
+		OPTIMIZER_HIDE_VAR(acc);	//否则整个循环会被算成一个公式
+	}
+	v->sink += acc;
+}
+
+static void bench_add_per_elem(struct bench_vec *v)
+{
+	unsigned int	i;
+
+	for(i = 0; i < v->n; i++)
+		v->dst[i] = add_integer(v->a[i], v->b[i]);
+}
+
+static void bench_inline_loop(struct bench_vec *v)
+{
+	unsigned int	i;
+
+	for(i = 0; i < v->n; i++)
+		v->dst[i] = v->a[i] + v->b[i];
+}
+
+static void bench_add_array(struct bench_vec *v)
+{
+	add_integer_array(v->dst, v->a, v->b, v->n);
+}
+
+static void bench_sub_array(struct bench_vec *v)
+{
+	sub_integer_array(v->dst, v->a, v->b, v->n);
+}
+
+static void bench_add_array_sat(struct bench_vec *v)
+{
+	add_integer_array_sat(v->dst, v->a, v->b, v->n);
+}
+
+static void bench_sum_array(struct bench_vec *v)
+{
+	v->sink += sum_integer_array(v->a, v->n);
+}
+
+/* 逐位计算的CRC-8，即sht20驱动原来的写法，用来和crc8_sensor模块的查表实现对比 */
+static u8 crc8_bitwise_msb(const u8 *data, size_t len, u8 crc)
+{
+	int		j;
+
+	while(len--)
+	{
+		crc ^= *data++;
+		for(j = 0; j < 8; j++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+	}
+
+	return crc;
+}
+
+static u8 crc8_bitwise_lsb(const u8 *data, size_t len, u8 crc)
+{
+	int		j;
+
+	while(len--)
+	{
+		crc ^= *data++;
+		for(j = 0; j < 8; j++)
+			crc = (crc & 0x01) ? (crc >> 1) ^ 0x8c : (crc >> 1);
+	}
+
+	return crc;
+}
+
+static void bench_crc8_bitwise_msb(struct bench_vec *v)
+{
+	v->sink += crc8_bitwise_msb((const u8 *)v->a, v->n * sizeof(s32), 0);
+}
+
+static void bench_crc8_sensirion(struct bench_vec *v)
+{
+	v->sink += sensor_crc8_sensirion((const u8 *)v->a, v->n * sizeof(s32), 0);
+}
+
+static void bench_crc8_bitwise_lsb(struct bench_vec *v)
+{
+	v->sink += crc8_bitwise_lsb((const u8 *)v->a, v->n * sizeof(s32), 0);
+}
+
+static void bench_crc8_maxim(struct bench_vec *v)
+{
+	v->sink += sensor_crc8_maxim((const u8 *)v->a, v->n * sizeof(s32), 0);
+}
+
+static const struct bench_case bench_cases[] = {
+	{ "add_integer",			bench_add_integer,		false },
+	{ "sub_integer",			bench_sub_integer,		false },
+	{ "inline add",				bench_inline_add,		false },
+	{ "add_integer/elem",		bench_add_per_elem,		true },
+	{ "inline loop",			bench_inline_loop,		true },
+	{ "add_integer_array",		bench_add_array,		true },
+	{ "sub_integer_array",		bench_sub_array,		true },
+	{ "add_integer_array_sat",	bench_add_array_sat,	true },
+	{ "sum_integer_array",		bench_sum_array,		true },
+	{ "crc8 bitwise msb",		bench_crc8_bitwise_msb,	true },
+	{ "sensor_crc8_sensirion",	bench_crc8_sensirion,	true },
+	{ "crc8 bitwise lsb",		bench_crc8_bitwise_lsb,	true },
+	{ "sensor_crc8_maxim",		bench_crc8_maxim,		true },
+};
+
+/* 分段计时，返回总纳秒数，*ops返回实际运算次数 */
+static u64 bench_time(const struct bench_case *bc, struct bench_vec *v, unsigned long iters, u64 *ops)
+{
+	unsigned long	slices, i;
+	unsigned int	per = bc->vector ? v->n : BENCH_SLICE;
+	u64				total = 0, t0;
+
+	slices = DIV_ROUND_UP(iters, per);
+	for(i = 0; i < slices; i++)
+	{
+		preempt_disable();
+		t0 = ktime_get_ns();
+		bc->fn(v);
+		total += ktime_get_ns() - t0;
+		preempt_enable();
+		cond_resched();
+	}
+
+	*ops = (u64)slices * per;
+	return total;
+}
+
+/* 跑全部测试，结果写入bench_report，调用者持有bench_lock */
+static int bench_run(void)
+{
+	unsigned long		iters = READ_ONCE(iterations);	//参数可能被同时修改，只读一次
+	struct bench_vec	v = { .n = READ_ONCE(veclen) };
+	u64					ns, ops, nsop, mops;
+	size_t				len = 0;
+	unsigned int		i;
+
+	if(iters == 0 || v.n == 0 || v.n > BENCH_VECLEN_MAX)
+		return -EINVAL;
+
+	v.a = kvmalloc_array(v.n, sizeof(s32), GFP_KERNEL);
+	v.b = kvmalloc_array(v.n, sizeof(s32), GFP_KERNEL);
+	v.dst = kvmalloc_array(v.n, sizeof(s32), GFP_KERNEL);
+	if(!v.a || !v.b || !v.dst)
+	{
+		kvfree(v.a);
+		kvfree(v.b);
+		kvfree(v.dst);
+		return -ENOMEM;
+	}
+	get_random_bytes(v.a, v.n * sizeof(s32));
+	get_random_bytes(v.b, v.n * sizeof(s32));
+
+	len += scnprintf(bench_report + len, sizeof(bench_report) - len,
+			"iterations %lu veclen %u\n%-24s %12s %12s\n", iters, v.n, "case", "ns/op", "Mops/s");
+	for(i = 0; i < ARRAY_SIZE(bench_cases); i++)
+	{
+		ns = bench_time(&bench_cases[i], &v, iters, &ops);
+		if(ns == 0)
+			ns = 1;
+		nsop = div64_u64(ns * 1000, ops);		//千分之一纳秒
+		mops = div64_u64(ops * 100000, ns);		//百分之一Mops/s
+		len += scnprintf(bench_report + len, sizeof(bench_report) - len,
+				"%-24s %8llu.%03llu %9llu.%02llu\n", bench_cases[i].name,
+				nsop / 1000, nsop % 1000, mops / 100, mops % 100);
+	}
+	bench_len = len;
+
+	kvfree(v.a);
+	kvfree(v.b);
+	kvfree(v.dst);
+	return 0;
+}
+
+static ssize_t bench_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	static const char	hint[] = "not run yet, echo 1 > bench\n";
+	ssize_t				rv;
+
+	mutex_lock(&bench_lock);
+	if(bench_len)
+		rv = simple_read_from_buffer(buf, count, ppos, bench_report, bench_len);
+	else
+		rv = simple_read_from_buffer(buf, count, ppos, hint, sizeof(hint) - 1);
+	mutex_unlock(&bench_lock);
+
+	return rv;
+}
+
+static ssize_t bench_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	int		rv;
+
+	mutex_lock(&bench_lock);
+	rv = bench_run();
+	mutex_unlock(&bench_lock);
+
+	return rv ? rv : count;
+}
+
+static const struct file_operations bench_fops = {
+	.owner	=	THIS_MODULE,
+	.open	=	simple_open,
+	.read	=	bench_read,
+	.write	=	bench_write,
+	.llseek	=	default_llseek,
+};
 static __init int test_init(void)
 {
 	long result = 0;
@@ -32,11 +317,15 @@ static __init int test_init(void)
 		result = sub_integer(a, b);
 	}
 	printk(KERN_ALERT "The %s result is %ld\n", AddOrSub==1?"Add":"Sub", result);
+
+	bench_dir = debugfs_create_dir(BENCH_NAME, NULL);
+	debugfs_create_file("bench", 0600, bench_dir, NULL, &bench_fops);
 	return 0;
 }
 
 static __exit void test_exit(void)
 {
+	debugfs_remove_recursive(bench_dir);
 	printk(KERN_ALERT "test exit\n");
 }
 
@@ -46,6 +335,10 @@ module_exit(test_exit);
 module_param(a, long, S_IRUGO);
 module_param(b, long, S_IRUGO);
 module_param(AddOrSub, int, S_IRUGO);
+module_param(iterations, ulong, 0644);
+module_param(veclen, uint, 0644);
+MODULE_PARM_DESC(iterations, "Operations per benchmark case");
+MODULE_PARM_DESC(veclen, "Vector length for the batch cases (max 1048576)");
 
 //描述信息
 MODULE_LICENSE("Dual BSD/GPL");
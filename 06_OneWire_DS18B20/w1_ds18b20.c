@@ -25,6 +25,9 @@
 #include <linux/cdev.h>				// cdev相关函数
 #include <linux/platform_device.h>	// platform相关结构体
 #include <linux/delay.h>
+#include "add_sub.h"				// ds18b20_temp_milli()定点换算，由add_sub模块导出
+#include "crc8_sensor.h"			// sensor_crc8_maxim()查表CRC，由crc8_sensor模块导出
+#include "dsp_filter.h"				// 中值和EMA滤波器，由dsp_filter模块导出
 
 
 #define DEV_NAME				"w1_ds18b20"	// 最后在/dev路径下的设备名称，应用层open的字符串名
@@ -45,9 +48,12 @@
 #define Convert_T				0x44	// 启动一个单一的温度转换。
 #define Read_Data				0xBE	// 主机读取暂存寄存器的内容
 
-#define CRC_MODEL				0x31
-#define CRC_SUCCESS				0
-#define CRC_FAIL				1
+#define SCRATCHPAD_LEN			9		// 暂存器：温度L/H、TH、TL、配置、3个保留字节、CRC
+#define SCRATCHPAD_RESERVED		5		// 第一个保留字节，读出恒为0xFF
+#define SCRATCHPAD_RESERVED_VAL	0xFF
+
+#define FILTER_MEDIAN_LEN		3		// 中值窗口，去掉偶发的读错
+#define FILTER_EMA_SHIFT		2		// EMA系数1/4
 
 static int dev_major = DEV_MAJOR;		/* 主设备号 */
 
@@ -57,6 +63,8 @@ struct gpio_w1_priv {
 	struct class		*dev_class;		// 自动创建设备节点的类
 	struct device		*dev;
 	spinlock_t			lock;
+	struct dsp_median	median;			// temp_filtered用的滤波器状态，由lock保护
+	struct dsp_ema		ema;
 };
 
 struct gpio_desc		*w1_gpiod;		// gpio描述符
@@ -264,18 +272,19 @@ static void DS18B20_writeByte(uint8_t Bety)
 
 
 /**
- * @name: static uint16_t DS18B20_SampleData(struct gpio_w1_priv *priv)
+ * @name: static int DS18B20_SampleData(struct gpio_w1_priv *priv, s32 *milli)
  * @description: 读取温度值
  * @param {gpio_w1_priv} *priv 私有数据结构体
- * @return {*}
+ * @param {s32} *milli 输出温度，单位m'C，负温度保留符号
+ * @return 0 successfully , !0 failure
  */
-static uint16_t DS18B20_SampleData(struct gpio_w1_priv *priv)
+static int DS18B20_SampleData(struct gpio_w1_priv *priv, s32 *milli)
 {
 	unsigned long	flags;
 	uint16_t		temp = 0;
-	uint8_t			temp_H = 0;
-	uint8_t			temp_L = 0;
+	uint8_t			scratch[SCRATCHPAD_LEN];
 	int				rv = 0;
+	int				i;
 
 	spin_lock_irqsave(&priv->lock, flags);	// 获取自旋锁
 
@@ -310,22 +319,34 @@ static uint16_t DS18B20_SampleData(struct gpio_w1_priv *priv)
 	DS18B20_writeByte(Skip_ROM);	// 跳过ROM，直接对总线上的所有设备进行操作
 	DS18B20_writeByte(Read_Data);	// 读取温度数据
 
-	/* 4. 读取温度数据 */
-	temp_L = DS18B20_readByte();	// 先读低8位
-	temp_H = DS18B20_readByte();	// 再读高8位
+	/* 4. 读取整个暂存器，前两个字节是温度的低8位和高8位，最后一个字节是CRC */
+	for(i = 0; i < SCRATCHPAD_LEN; i++)
+	{
+		scratch[i] = DS18B20_readByte();
+	}
 
 	spin_unlock_irqrestore(&priv->lock, flags);	// 释放自旋锁
 
+	/* 包括CRC字节在内整个算一遍，结果为0说明数据完整 */
+	if(sensor_crc8_maxim(scratch, SCRATCHPAD_LEN, SENSOR_CRC8_MAXIM_INIT) != 0)
+	{
+		printk("%s():%d DS18B20 scratchpad CRC error\n", __FUNCTION__, __LINE__);
+		return -EIO;
+	}
 
-	temp = (temp_H << 8) | temp_L;	// 将高8位和低8位合并成一个16位的数据
-
-	/* 5. 如果温度为负数，需要进行补码操作 */
-	if(temp & 0x8000)	// 判断最高位是否为1，其实也可以直接判断temp是否<0
+	/* 总线一直被拉低时读到全0，CRC也是0；手册规定保留字节5固定为0xFF，用它排除这种情况 */
+	if(scratch[SCRATCHPAD_RESERVED] != SCRATCHPAD_RESERVED_VAL)
 	{
-		temp = ~temp + 1;
+		printk("%s():%d DS18B20 scratchpad invalid, reserved byte %x\n", __FUNCTION__, __LINE__, scratch[SCRATCHPAD_RESERVED]);
+		return -EIO;
 	}
 
-	return temp;
+	temp = (scratch[1] << 8) | scratch[0];	// 将高8位和低8位合并成一个16位的数据
+
+	/* 5. 温度寄存器是1/16 'C的补码，换算成带符号的m'C */
+	*milli = ds18b20_temp_milli(temp);
+
+	return 0;
 
 undo_spin_unlock:
 	spin_unlock_irqrestore(&priv->lock, flags);	// 释放自旋锁
@@ -366,12 +387,17 @@ static int w1_open(struct inode *inode, struct file *file)
 static ssize_t w1_read(struct file *filp, char __user *buf, size_t cnt, loff_t *off)
 {
 	int rv = 0;
-	uint16_t temp = 0;
+	s32 temp = 0;
 
 	struct gpio_w1_priv *priv = filp->private_data;	// 获取私有数据结构体的地址
 
-	temp = DS18B20_SampleData(priv);	// 读取温度值
-	printk("%s():%d DS18B20_SampleData temp = %x\n", __FUNCTION__, __LINE__, temp);
+	if(cnt < sizeof(temp))
+		return -EINVAL;
+
+	rv = DS18B20_SampleData(priv, &temp);	// 读取温度值，单位m'C
+	if(rv)
+		return rv;
+	printk("%s():%d DS18B20_SampleData temp = %d\n", __FUNCTION__, __LINE__, temp);
 
 	rv = copy_to_user(buf, &temp, sizeof(temp));	// 将温度值拷贝到用户空间
 	if(rv)
@@ -418,12 +444,15 @@ static struct file_operations w1_fops = {
  */
 static ssize_t temp_show(struct device *devp, struct device_attribute *attr, char *buf)
 {
-	uint16_t temp = 0;
+	s32 temp = 0;
+	int rv;
 	struct gpio_w1_priv *priv = dev_get_drvdata(devp);	// 获取私有数据结构体的地址
 
-	temp = DS18B20_SampleData(priv);	// 读取温度值
+	rv = DS18B20_SampleData(priv, &temp);	// 读取温度值
+	if(rv)
+		return rv;
 
-	return sprintf(buf, "temp = %d\n", temp*625); // 温度值 = temp * 0.0625, 这里返回的是温度值的10000倍
+	return sprintf(buf, "temp = %d\n", temp); // 单位m'C，即温度值的1000倍
 }
 
 /**
@@ -443,6 +472,34 @@ static ssize_t temp_store(struct device *devp, struct device_attribute *attr, co
 /* 声明并初始化一个device_attribute结构体 */
 DEVICE_ATTR(temp, 0644, temp_show, temp_store);
 
+/**
+ * @name: static ssize_t temp_filtered_show(struct device *devp, struct device_attribute *attr, char *buf)
+ * @description: 采样一次，经过中值和EMA滤波后显示，单位m'C，用户态不需要再自己滤波
+ * @param {device} *devp 设备指针,创建file时候会指定dev
+ * @param {device_attribute} *attr 设备属性,创建时候传入
+ * @param {char} *buf 传出给sysfs中显示的buf
+ * @return 显示的字节数
+ */
+static ssize_t temp_filtered_show(struct device *devp, struct device_attribute *attr, char *buf)
+{
+	s32 temp = 0;
+	int rv;
+	unsigned long flags;
+	struct gpio_w1_priv *priv = dev_get_drvdata(devp);	// 获取私有数据结构体的地址
+
+	rv = DS18B20_SampleData(priv, &temp);	// 读取温度值
+	if(rv)
+		return rv;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	temp = dsp_ema_update(&priv->ema, dsp_median_update(&priv->median, temp));
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	return sprintf(buf, "temp = %d\n", temp);
+}
+
+DEVICE_ATTR(temp_filtered, 0444, temp_filtered_show, NULL);
+
 /**
  * @name: static int gpio_w1_probe(struct platform_device *pdev)
  * @description: probe函数实现字符设备的注册和设备树的解析
@@ -522,8 +579,10 @@ static int gpio_w1_probe(struct platform_device *pdev)
 		goto undo_class;
 	}
 
-	/* 5.初始化自旋锁 */
+	/* 5.初始化自旋锁和滤波器 */
 	spin_lock_init(&priv->lock);
+	dsp_median_init(&priv->median, FILTER_MEDIAN_LEN);
+	dsp_ema_init(&priv->ema, FILTER_EMA_SHIFT);
 
 	/* 6.创建sys属性在platform_device中 */
 	rv = device_create_file(dev, &dev_attr_temp);
@@ -533,6 +592,13 @@ static int gpio_w1_probe(struct platform_device *pdev)
 		goto undo_device;
 	}
 
+	rv = device_create_file(dev, &dev_attr_temp_filtered);
+	if(rv)
+	{
+		rv = -ENOMEM;
+		goto undo_attr;
+	}
+
 	priv->dev = dev;	// 将设备指针存入私有数据结构体中
 
 	/* 7.保存私有数据结构体指针 */
@@ -542,6 +608,9 @@ static int gpio_w1_probe(struct platform_device *pdev)
 
 	return 0;
 
+undo_attr:
+	device_remove_file(dev, &dev_attr_temp);
+
 undo_device:
 	device_destroy(priv->dev_class, devno);
 
@@ -570,6 +639,7 @@ static int gpio_w1_remove(struct platform_device *pdev)
 	dev_t devno = MKDEV(dev_major, 0);	// 获取设备号
 
 	/* 删除sys属性 */
+	device_remove_file(priv->dev, &dev_attr_temp_filtered);
 	device_remove_file(priv->dev, &dev_attr_temp);
 
 	device_destroy(priv->dev_class, devno);	// 销毁设备
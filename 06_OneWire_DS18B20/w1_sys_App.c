@@ -21,12 +21,12 @@
 #include <time.h>
 #include <errno.h>
 
-int ds18b20_get_temperature(float *temp);
+int ds18b20_get_temperature(long *temp);
 
 
 int main (int argc, char **argv)
 {
-	float		temp;
+	long		temp;
 
 	if(ds18b20_get_temperature(&temp) < 0)
 	{
@@ -34,12 +34,13 @@ int main (int argc, char **argv)
 		return -1;
 	}
 
-	printf("DS18B20 get temperature: %.4f 'C\n", temp);
+	/* 驱动返回m'C的整数，直接按整数部分和小数部分打印，不需要浮点 */
+	printf("DS18B20 get temperature: %s%ld.%03ld 'C\n", temp < 0 ? "-" : "", labs(temp) / 1000, labs(temp) % 1000);
 
 	return 0;
 } 
 
-int ds18b20_get_temperature(float *temp)
+int ds18b20_get_temperature(long *temp)
 {
 	const char		*w1_path = "/sys/class/w1_ds18b20/w1_ds18b20/"; // my_ds18b20_driver
 	char			ds_path[50]; /* DS18B20 采样文件路径 */
@@ -70,7 +71,8 @@ int ds18b20_get_temperature(float *temp)
     }
 
 	// 读取文件中的内容将会触发 DS18B20温度传感器采样
-	if(read(fd, buf, sizeof(buf)) < 0)
+	memset(buf, 0, sizeof(buf));	/* 保证字符串以\0结尾 */
+	if(read(fd, buf, sizeof(buf) - 1) < 0)
 	{
 		printf("read %s error: %s\n", ds_path, strerror(errno));
 		rv = -5;
@@ -87,8 +89,8 @@ int ds18b20_get_temperature(float *temp)
     }
 	ptr+=7;	/* 跳过"temp = "字符串 */
 
-	/* 接下来我们使用 atof() 函数将采样温度值字符串形式，转化成 float 类型。*/
-    *temp = atof(ptr)/10000;
+	/* 采样温度值单位为m'C，用strtol()转换成整数 */
+    *temp = strtol(ptr, NULL, 10);
 
 cleanup: 
     close(fd);
@@ -26,6 +26,10 @@
 #include <linux/i2c.h>                  //i2c相关
 #include <linux/delay.h>                // 延时函数头文件
 #include <linux/cdev.h>                 //cdev相关函数
+#include "add_sub.h"                    // sht2x_temp_milli()/sht2x_rh_milli()定点换算，由add_sub模块导出
+#include "crc8_sensor.h"                // sensor_crc8_sensirion()查表CRC，由crc8_sensor模块导出
+#include "dsp_filter.h"                 // 中值和EMA滤波器，由dsp_filter模块导出
+#include <linux/mutex.h>
 
 #define DEV_NAME			"sht20"		// 最后在/dev路径下的设备名称，应用层open的字符串名
 #define DEV_CNT				1
@@ -41,7 +45,9 @@
 #define T_MEASURE_HOLD_CMD			0xe3	// 主机模式触发温度测量
 #define RH_MEASURE_HOLD_CMD			0xe5	// 主机模式触发湿度测量
 
-#define CRC_MODEL					0x31
+#define FILTER_MEDIAN_LEN			3		// 中值窗口，去掉偶发的读错
+#define FILTER_EMA_SHIFT			2		// EMA系数1/4
+
 #define CRC_SUCCESS					0
 #define CRC_FAIL					1
 
@@ -53,6 +59,9 @@ struct sht20_priv {
 	struct class		*dev_class;		// 自动创建设备节点的类
 	struct i2c_client	*client;	// i2c设备的client结构体
 	struct device		*dev;		// 设备结构体
+	struct mutex		filter_lock;	// 保护下面的滤波器状态
+	struct dsp_median	median[2];	// 0为温度，1为湿度
+	struct dsp_ema		ema[2];
 };
 
 /* sht20软复位 */
@@ -77,22 +86,10 @@ static int sht20_soft_reset(struct i2c_client *client)
 	return rv;
 }
 
-/* 检查CRC */
+/* 检查CRC，多项式0x31，初值0x00 */
 static int sht20_crc8(unsigned char *data, int len, unsigned char checksum)
 {
-	unsigned char 	crc = 0x00;
-	int				i,j;
-
-	for(i=0;i<len;i++)
-	{
-		// crc值对data每个位进行按位异或运算，位相同则为0，否则为1
-		crc ^= *data++;
-
-		for(j=0; j<8; j++)
-		{
-			crc = (crc & 0x80)?(crc << 1) ^ CRC_MODEL : (crc << 1);
-		}
-	}
+	unsigned char 	crc = sensor_crc8_sensirion(data, len, SENSOR_CRC8_SENSIRION_INIT);
 
 	if(checksum == crc)
 	{
@@ -245,19 +242,28 @@ static ssize_t sht20_read(struct file *filp, char __user *buf, size_t cnt, loff_
     int rv =0;
     struct sht20_priv *priv = filp->private_data;
     unsigned char tx_data[4];
+    s32 milli[2];       // 温度m'C、湿度千分之一%RH
 
-    read_t_rh_data(priv->client, tx_data);
+    if(cnt < sizeof(milli))
+        return -EINVAL;
+
+    rv = read_t_rh_data(priv->client, tx_data);
+    if(rv < 0)
+        return -EIO;
 
     printk("\n test %x %x %x %x \n", tx_data[0], tx_data[1], tx_data[2], tx_data[3]);
 
-    rv = copy_to_user(buf, tx_data, sizeof(tx_data));
+    milli[0] = sht2x_temp_milli((tx_data[0] << 8) | tx_data[1]);
+    milli[1] = sht2x_rh_milli((tx_data[2] << 8) | tx_data[3]);
+
+    rv = copy_to_user(buf, milli, sizeof(milli));
     if(rv)
     {
         dev_err(priv->dev, "copy to user failure!\n");
         return -EFAULT;
     }
 
-    return rv;
+    return sizeof(milli);
 }
 
 /**
@@ -295,8 +301,8 @@ static ssize_t temp_humi_show(struct device *pdev, struct device_attribute *attr
     int rv = 0;
     unsigned char tx_data[4];
     struct sht20_priv *priv = dev_get_drvdata(pdev);
-    unsigned int temp;
-    unsigned int humi;
+    s32 temp;
+    s32 humi;
 
     rv = read_t_rh_data(priv->client, tx_data);
     if(rv < 0)
@@ -305,11 +311,10 @@ static ssize_t temp_humi_show(struct device *pdev, struct device_attribute *attr
         return -EFAULT;
     }
 
-    // 为什么14位的temp和12位的humi放大的是同一个倍数呢？
-    // 因为temp的单位是C，humi我们需要是%，即百分数
-    temp = ( (tx_data[0] << 8) | tx_data[1] );      // 放大100倍
+    // 14位的temp和12位的humi都按满量程2^16换算，结果为千分之一单位的整数
+    temp = sht2x_temp_milli( (tx_data[0] << 8) | tx_data[1] );     // m'C
 
-    humi = ( (tx_data[2] << 8) | tx_data[3] );      // 放大100倍
+    humi = sht2x_rh_milli( (tx_data[2] << 8) | tx_data[3] );       // 千分之一%RH
     printk("show_test %x %x %x %x \n", tx_data[0], tx_data[1], tx_data[2], tx_data[3]);
 
     return sprintf(buf, "temp=%d,humi=%d\n",temp, humi);//1000倍
@@ -333,12 +338,51 @@ static ssize_t temp_humi_store(struct device *dev, struct device_attribute *attr
 /*声明并初始化一个 device_attribute结构体*/
 DEVICE_ATTR(temp_humi, 0644, temp_humi_show, temp_humi_store);
 
+/**
+ * @name: static ssize_t temp_humi_filtered_show(struct device *pdev, struct device_attribute *attr, char *buf)
+ * @description: 采样一次，温湿度各自经过中值和EMA滤波后显示，单位同temp_humi
+ * @param {device} *pdev 设备指针,创建file时候会指定dev
+ * @param {device_attribute} *attr 设备属性,创建时候传入
+ * @param {char} *buf 传出给sysfs中显示的buf
+ * @return 显示的字节数
+ */
+static ssize_t temp_humi_filtered_show(struct device *pdev, struct device_attribute *attr, char *buf)
+{
+    int rv = 0;
+    unsigned char tx_data[4];
+    struct sht20_priv *priv = dev_get_drvdata(pdev);
+    s32 val[2];
+    int i;
+
+    rv = read_t_rh_data(priv->client, tx_data);
+    if(rv < 0)
+    {
+        dev_err(priv->dev, "read_t_rh_data to show failure!\n");
+        return -EFAULT;
+    }
+
+    val[0] = sht2x_temp_milli( (tx_data[0] << 8) | tx_data[1] );
+    val[1] = sht2x_rh_milli( (tx_data[2] << 8) | tx_data[3] );
+
+    mutex_lock(&priv->filter_lock);
+    for(i = 0; i < 2; i++)
+    {
+        val[i] = dsp_ema_update(&priv->ema[i], dsp_median_update(&priv->median[i], val[i]));
+    }
+    mutex_unlock(&priv->filter_lock);
+
+    return sprintf(buf, "temp=%d,humi=%d\n", val[0], val[1]);
+}
+
+DEVICE_ATTR(temp_humi_filtered, 0444, temp_humi_filtered_show, NULL);
+
 /*i2c总线设备函数集:.probe函数只需要添加、注册一个字符设备即可。 */
 static int sht20_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
     struct sht20_priv   *priv = NULL;   // 临时存放私有属性结构体
     dev_t               devno;          // 设备的主次设备号
     int                 rv = 0;
+    int                 i;
 
     // 0.给priv分配空间
     priv = devm_kzalloc(&client->dev, sizeof(struct sht20_priv), GFP_KERNEL);
@@ -401,12 +445,25 @@ static int sht20_probe(struct i2c_client *client, const struct i2c_device_id *id
     }
 
     //5.创建sysfs文件初始化
+    mutex_init(&priv->filter_lock);
+    for(i = 0; i < 2; i++)
+    {
+        dsp_median_init(&priv->median[i], FILTER_MEDIAN_LEN);
+        dsp_ema_init(&priv->ema[i], FILTER_EMA_SHIFT);
+    }
+
     if(device_create_file(priv->dev, &dev_attr_temp_humi))
     {
         rv = -ENOMEM;
         goto undo_device;
     }
 
+    if(device_create_file(priv->dev, &dev_attr_temp_humi_filtered))
+    {
+        rv = -ENOMEM;
+        goto undo_attr;
+    }
+
     //6.保存私有数据
     priv->client = client;
     i2c_set_clientdata(client, priv);
@@ -415,6 +472,9 @@ static int sht20_probe(struct i2c_client *client, const struct i2c_device_id *id
 
     return 0;
 
+undo_attr:
+    device_remove_file(priv->dev, &dev_attr_temp_humi);
+
 undo_device:
     device_destroy(priv->dev_class, devno);  //返回错误码,应用空间strerror查看
 
@@ -438,6 +498,7 @@ static int sht20_remove(struct i2c_client *client)
     dev_t devno = MKDEV(dev_major, 0);
 
     // 删除sys中的属性
+    device_remove_file(priv->dev, &dev_attr_temp_humi_filtered);
     device_remove_file(priv->dev, &dev_attr_temp_humi);
 
     // 注销每一个设备号
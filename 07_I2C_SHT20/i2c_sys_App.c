@@ -20,25 +20,31 @@
 #include <time.h>
 #include <errno.h>
 
-int sht20_get_temp_humi(float *temp, float *humi);
+int sht20_get_temp_humi(long *temp, long *humi);
+
+/* 驱动返回千分之一单位的整数，按整数部分和小数部分打印，不需要浮点 */
+static void print_milli(const char *name, long val, const char *unit)
+{
+    printf("sht20 get %s: %s%ld.%03ld %s\n", name, val < 0 ? "-" : "", labs(val) / 1000, labs(val) % 1000, unit);
+}
 
 int main(int argc, char **agrv)
 {
-    float   temp = 0;
-    float   humi = 0;
+    long    temp = 0;
+    long    humi = 0;
 
     if(sht20_get_temp_humi(&temp, &humi) < 0)
     {
         printf("ERROR: sht20 get temp and humi failure!\n");
         return -1;
     }
-    printf("sht20 get temp: %f 'C\n", temp);
-    printf("sht20 get humi: %f % \n", humi);
+    print_milli("temp", temp, "'C");
+    print_milli("humi", humi, "%");
 
     return 0;
 }
 
-int sht20_get_temp_humi(float *temp, float *humi)
+int sht20_get_temp_humi(long *temp, long *humi)
 {
     const char      *sht20_path = "/sys/class/sht20/sht20/";
     char            ds_path[50];
@@ -46,8 +52,6 @@ int sht20_get_temp_humi(float *temp, float *humi)
     DIR             *dirp = NULL;
     int             fd = -1;
     char            *ptr_begin = NULL;
-    char            *ptr_end   = NULL;
-    char            data_buf[16];
     int             rv = 0;
 
     if(!temp || !humi)
@@ -69,7 +73,9 @@ int sht20_get_temp_humi(float *temp, float *humi)
         return -3;
     }
 
-    if(read(fd, buf, sizeof(buf)) < 0)
+    memset(buf, 0, sizeof(buf));	/* 保证字符串以\0结尾 */
+
+    if(read(fd, buf, sizeof(buf) - 1) < 0)
     {
         printf("read %s error: %s\n", ds_path, strerror(errno));
         rv = -5;
@@ -77,27 +83,25 @@ int sht20_get_temp_humi(float *temp, float *humi)
     }
 
     ptr_begin = strstr(buf, "temp=");
-    ptr_end = strstr(buf, ",");
-
-    if( !ptr_begin || !ptr_end )
+    if( !ptr_begin )
     {
         printf("ERROR: Can not get temperature\n");
         rv = -6;
         goto cleanup;
     }
-    else
-    {
-        /* 因为此时ptr是指向 "temp="字符串的地址(即't'的地址)，那跳过5个字节(t=)后面的就是采样温度值 */
-         ptr_begin += strlen("temp=");
-         memcpy(data_buf, ptr_begin, ptr_end - ptr_begin);
-    }
 
-    *temp = -46.85 + 175.72/65536 * atof(data_buf);
+    /* 驱动已经换算好，temp单位m'C，humi单位千分之一%RH，strtol()在','处停止 */
+    *temp = strtol(ptr_begin + strlen("temp="), NULL, 10);
 
     ptr_begin = strstr(buf, "humi=");
-    ptr_begin += strlen("humi=");
+    if( !ptr_begin )
+    {
+        printf("ERROR: Can not get humidity\n");
+        rv = -6;
+        goto cleanup;
+    }
 
-    *humi = -6.0  + 125.0 /65536 * atof(ptr_begin);
+    *humi = strtol(ptr_begin + strlen("humi="), NULL, 10);
 
 cleanup: 
     close(fd);